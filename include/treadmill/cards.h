@@ -0,0 +1,55 @@
+#ifndef _treadmill_cards_h
+#define _treadmill_cards_h
+
+#include <treadmill/gc.h>
+#include <treadmill/table.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Card marking keeps large, pointer-dense objects (big arrays, hash tables)
+ * cheap to scan again when only a few of their pointers changed.
+ *
+ * The pointers of an object registered with TmHeap_track_cards are split in
+ * cards of TM_CARD_BYTES. Once the object has been scanned, storing a
+ * pointer into it and reporting it to Tm_write_barrier, with `field` being
+ * the byte offset of the slot, marks that card dirty and puts the object back
+ * in the grey area. Scanning it again then only visits the dirty cards,
+ * through the heap's scan_range function, so objects stored into it after it
+ * was scanned are not collected by mistake.
+ *
+ * Tracked objects are forgotten when they are released. Leaves, immortals
+ * and region objects can't be tracked. The heap finds the cards of an
+ * object through its cards table, keyed by the object.
+ */
+
+// Bytes of pointers per card.
+#define TM_CARD_BYTES 512
+
+typedef struct tm_cards_s {
+  TmObjectHeader *object;
+  size_t size;      // bytes of pointers covered
+  int scanned;      // whether the object was scanned since the last flip
+  int dirty;        // number of dirty cards
+  unsigned char marks[];
+} TmCards;
+
+// Tracks `size` bytes of pointers of an object, or resizes them if it was
+// already tracked.
+int TmHeap_track_cards(TmHeap *heap, TmObjectHeader *object, size_t size);
+TmCards* TmHeap_cards(TmHeap *heap, TmObjectHeader *object);
+
+// Called by the collector.
+int TmCards_mark(TmCards *cards, uintptr_t field);
+void TmCards_scan(TmHeap *heap, TmCards *cards, TmCallbackFn callback);
+void TmHeap_forget_cards(TmHeap *heap, TmObjectHeader *object);
+void TmHeap_reset_cards(TmHeap *heap);
+void TmHeap_destroy_cards(TmHeap *heap);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,15 +1,32 @@
 #ifndef _Tm_DArray_h_
 #define _Tm_DArray_h_
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 #include <treadmill/_dbg.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Arrays grow geometrically, by at least expand_rate slots, and only shrink
+ * back once they are a quarter full, so pushing and popping around a
+ * boundary doesn't reallocate every time.
+ *
+ * Arrays of up to TM_DARRAY_SMALL slots keep them inside the array itself,
+ * which saves an allocation for the many tiny ones, like rootsets and
+ * children lists.
+ */
+#define TM_DARRAY_SMALL 8
+
 typedef struct tm_darray_s {
   int end;
   int max;
   size_t element_size;
   size_t expand_rate;
   void **contents;
+  void *small[TM_DARRAY_SMALL];
 } Tm_DArray;
 
 Tm_DArray *Tm_DArray_create(size_t element_size, size_t initial_max);
@@ -62,4 +79,39 @@ error:
 
 #define Tm_DArray_free(E) free((E))
 
+/*
+ * Typed arrays store their elements inline rather than boxed behind
+ * pointers, and everything but growing is inlined:
+ *
+ *   Tm_Vec(TmCell*) cells;
+ *   Tm_Vec_init(&cells);
+ *   Tm_Vec_push(&cells, cell);  // 0, or -1 if it couldn't grow
+ *   TmCell *last = Tm_Vec_pop(&cells);
+ *   Tm_Vec_free(&cells);
+ */
+#define TM_VEC_MIN 16
+
+#define Tm_Vec(T) struct { int end; int max; T *contents; }
+
+#define Tm_Vec_init(V) ((V)->end = 0, (V)->max = 0, (V)->contents = NULL)
+#define Tm_Vec_free(V) (free((V)->contents), Tm_Vec_init(V))
+
+#define Tm_Vec_push(V, X) \
+  (((V)->end < (V)->max || \
+    Tm_Vec_grow(&(V)->contents, &(V)->max, sizeof(*(V)->contents)) == 0) ? \
+    ((V)->contents[(V)->end++] = (X), 0) : -1)
+
+#define Tm_Vec_pop(V) ((V)->contents[--(V)->end])
+#define Tm_Vec_at(V, I) ((V)->contents[(I)])
+#define Tm_Vec_last(V) ((V)->contents[(V)->end - 1])
+#define Tm_Vec_count(V) ((V)->end)
+#define Tm_Vec_clear(V) ((V)->end = 0)
+
+// `contents` is the address of the vector's element pointer.
+int Tm_Vec_grow(void *contents, int *max, size_t element_size);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -0,0 +1,56 @@
+#ifndef _treadmill_fork_h
+#define _treadmill_fork_h
+
+#include <treadmill/gc.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Forked collection moves tracing out of the process. Heaps with
+ * fork_collect set fork at each flip, once the rootset is known: the child
+ * traces its copy-on-write image of the heap like a flip followed by a full
+ * scan would, writes the address of every object left ecru to a pipe and
+ * exits.
+ *
+ * Objects unreachable when the child was forked stay unreachable, unless the
+ * program held on to one the rootset didn't report. Pinning is how it says
+ * so: the parent keeps what it reads from the pipe, without blocking,
+ * whenever Tm_allocate would take a scan step, and condemns it all at the
+ * next flip, which waits for whatever is left. If anything was pinned since
+ * the fork, it drops the report instead, and the next child finds the
+ * garbage again. Objects allocated after the fork are left for the next
+ * child too.
+ *
+ * Weak references could hand a condemned object back to the program, so
+ * heaps with weak references or tables keep collecting in process.
+ */
+
+// Dead objects read from the pipe at once.
+#define TM_FORK_BATCH 512
+
+typedef void (*TmForkTraceFn)(TmHeap *heap, Tm_DArray *rootset);
+
+typedef struct tm_fork_s {
+  int pid;
+  int fd;
+  int stale;   // the report can't be used, like after a pin
+  size_t used; // bytes in the batch
+  TmObjectHeader *batch[TM_FORK_BATCH];
+  Tm_Vec(TmObjectHeader*) dead;
+} TmFork;
+
+// Forks a child running trace on the rootset. Returns -1 if it couldn't.
+int TmFork_start(TmHeap *heap, Tm_DArray *rootset, TmForkTraceFn trace);
+// Reads what the child reported so far.
+void TmFork_poll(TmHeap *heap);
+// Waits for the child to be done and hands its dead objects to condemn.
+void TmFork_finish(TmHeap *heap, TmCallbackFn condemn);
+void TmFork_destroy(TmHeap *heap);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,18 +1,92 @@
 #ifndef _treadmill_gc_h
 #define _treadmill_gc_h
 
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include <treadmill/darray.h>
 #include <treadmill/_dbg.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 struct tm_cell_s;
 
+#ifdef TM_COMPACT_CELLS
+
+/*
+ * Compact cells live in a single arena reserved per heap and link to each
+ * other by index, with the colour packed next to the indices: 16 bytes per
+ * cell instead of 32.
+ */
+#define TM_INDEX_BITS 28
+#define TM_MAX_CELLS  (1 << TM_INDEX_BITS)
+
+typedef struct tm_cell_s {
+  void *value;
+  unsigned long long next : TM_INDEX_BITS;
+  unsigned long long prev : TM_INDEX_BITS;
+  unsigned long long ecru : 1;
+  unsigned long long flags : 7;
+} TmCell;
+
+#else
+
 typedef struct tm_cell_s {
   struct tm_cell_s *next;
   struct tm_cell_s *prev;
   void *value;
   char ecru;
+  unsigned char flags;
 } TmCell;
 
+#endif
+
+/*
+ * Allocation flags.
+ *
+ * TM_LEAF objects hold no pointers to other objects: they go straight to
+ * black when reached, without calling scan_pointers.
+ *
+ * TM_IMMORTAL objects are never collected. They are taken out of the
+ * treadmill into a permanent segment, and the ones holding pointers are
+ * scanned once per flip as an extension of the rootset.
+ */
+#define TM_LEAF      1
+#define TM_IMMORTAL  2
+
+// Set on immortal objects mapped from a heap image, which are never released.
+#define TM_IMAGE     4
+
+// Set on the cells shared by the objects of a region.
+#define TM_REGION    8
+
+// Set on objects whose pointers are split in cards (see cards.h).
+#define TM_CARDS     16
+
+/*
+ * Set on pretenured immortals, which are only scanned at a flip when the
+ * write barrier stored a collected object into them (TM_REMEMBERED).
+ *
+ * They still die: every TM_OLD_EVERY flips, they go back into the treadmill
+ * for one collection, and those that survive it are pretenured again.
+ */
+#define TM_OLD        32
+#define TM_REMEMBERED 64
+#define TM_OLD_EVERY  16
+
+/*
+ * Allocation hints, combined with the flags above.
+ *
+ * TM_LONG_LIVED objects are expected to live as long as the program, like
+ * module tables, classes or compiled code. They are pretenured: allocated
+ * straight into the immortal segment, and only traced once every
+ * TM_OLD_EVERY flips, unless a pointer to a collected object is stored into
+ * them, which has to be reported to Tm_write_barrier.
+ */
+#define TM_LONG_LIVED 0x100
+
 typedef struct tm_object_header_s {
   TmCell *cell;
 } TmObjectHeader;
@@ -24,39 +98,186 @@ typedef struct tm_state_header_s {
   TmRootsetFn rootset;
 } TmStateHeader;
 
+// Children waiting to be shaded during a full scan (a power of two).
+#define TM_MARK_BUFFER 16
+
 struct tm_heap_s;
+struct tm_snapshot_s;
+struct tm_weak_ref_s;
+struct tm_weak_table_s;
+struct tm_image_s;
+struct tm_trace_s;
+struct tm_slab_s;
+struct tm_region_s;
+struct tm_table_s;
+struct tm_sites_s;
+struct tm_fork_s;
 typedef void (*TmReleaseFn)(void *value);
 typedef void (*TmCallbackFn)(struct tm_heap_s *state, TmObjectHeader *object);
 typedef void (*TmScanPointersFn)(struct tm_heap_s *state, TmObjectHeader *object, TmCallbackFn callback);
 
+// Called when an allocation can't be satisfied even after a full collection.
+// Returns non-zero if it let go of something, so the allocation is retried.
+typedef int (*TmOutOfMemoryFn)(struct tm_heap_s *heap);
+
+// Like TmScanPointersFn, but reports where each pointer is stored. Optional,
+// only heap images need it.
+typedef void (*TmSlotFn)(struct tm_heap_s *state, TmObjectHeader **slot);
+typedef void (*TmScanSlotsFn)(struct tm_heap_s *state, TmObjectHeader *object, TmSlotFn callback);
+
+// Like TmScanPointersFn, but only for the pointers stored between the byte
+// offsets `from` (included) and `to`. Optional, only card marking uses it.
+typedef void (*TmScanRangeFn)(struct tm_heap_s *state, TmObjectHeader *object, size_t from, size_t to, TmCallbackFn callback);
+
 typedef struct tm_heap_s {
   TmCell *bottom;
   TmCell *top;
   TmCell *free;
   TmCell *scan;
   int growth_rate;
+  int max_size;
+  int capacity;
   int allocs;
   int scan_every;
   int warm;
+  int huge_pages;
+  int reserve;
+  int pending;
+  int immortals;
+  TmCell *immortal;
   size_t object_size;
   TmReleaseFn release;
   TmScanPointersFn scan_pointers;
+  TmScanSlotsFn scan_slots;
+  TmScanRangeFn scan_range;
+  TmOutOfMemoryFn out_of_memory;
   TmStateHeader *state;
   Tm_DArray *chunks;
+  struct tm_snapshot_s *snapshot;
+  struct tm_weak_ref_s *weak_refs;
+  struct tm_weak_table_s *weak_tables;
+  struct tm_image_s *image;
+  Tm_DArray *images;
+  struct tm_trace_s *trace;
+  int slab_bodies;
+  struct tm_slab_s *slabs;
+  void *slab_free;
+  struct tm_region_s *region;
+  struct tm_table_s *cards;
+  struct tm_table_s *pins;
+  struct tm_sites_s *sites;
+  Tm_Vec(TmObjectHeader*) remembered;
+  int flips;
+  int collecting_old;
+  int fork_collect;
+  struct tm_fork_s *fork;
+  TmObjectHeader *marks[TM_MARK_BUFFER];
+  int mark_head;
+  int mark_count;
+#ifdef TM_COMPACT_CELLS
+  TmCell *cells;
+  int used;
+#endif
 } TmHeap;
 
+#ifdef TM_COMPACT_CELLS
+#define TmCell_next(H, C)        ((H)->cells + (C)->next)
+#define TmCell_prev(H, C)        ((H)->cells + (C)->prev)
+#define TmCell_set_next(H, C, N) ((C)->next = (N) - (H)->cells)
+#define TmCell_set_prev(H, C, P) ((C)->prev = (P) - (H)->cells)
+#else
+#define TmCell_next(H, C)        ((C)->next)
+#define TmCell_prev(H, C)        ((C)->prev)
+#define TmCell_set_next(H, C, N) ((C)->next = (N))
+#define TmCell_set_prev(H, C, P) ((C)->prev = (P))
+#endif
+
+/*
+ * Chunks are mapped from the process-wide pool and linked into the treadmill
+ * lazily: only the first `linked` cells are part of the ring, the rest are
+ * held in the heap's reserve until Tm_allocate runs out of white cells.
+ */
 typedef struct tm_chunk_s {
-  TmCell *head;
-  TmCell *tail;
+  TmCell *cells;
+  int size;
+  int linked;
+  size_t mapped;
+  int huge;
 } TmChunk;
 
 TmHeap* TmHeap_new(TmStateHeader *state, int size, int growth_rate, int scan_every, size_t object_size, TmReleaseFn release_fn, TmScanPointersFn scan_pointers_fn);
 void TmHeap_grow(TmHeap *heap, int size);
+int TmHeap_link(TmHeap *heap, int count);
+void TmHeap_adopt(TmHeap *heap, TmCell *cell);
+TmObjectHeader* TmHeap_promote(TmHeap *heap, TmObjectHeader *object, int flags);
+int TmHeap_shrink(TmHeap *heap);
 
-TmObjectHeader* Tm_allocate(TmHeap *heap);
+TmObjectHeader* Tm_allocate_slow(TmHeap *heap, int flags);
 void Tm_scan(TmHeap *heap);
+void Tm_scan_all(TmHeap *heap);
+void Tm_shade(TmHeap *heap, TmObjectHeader *object);
+void Tm_rescan(TmHeap *heap, TmObjectHeader *object);
 void Tm_flip(TmHeap *heap);
 
+/*
+ * Mutators call the write barrier after storing `value` into a pointer field
+ * of `object`. `field` identifies the field within the object, like its
+ * offset or its index in an array of children. For objects tracked with
+ * cards, it must be the byte offset scan_range knows the field by.
+ */
+void Tm_write_barrier(TmHeap *heap, TmObjectHeader *object, uintptr_t field, TmObjectHeader *value);
+
+/*
+ * Allocation is inlined into the caller as long as there's a white cell, the
+ * heap owes no scan step and a body is at hand: a released slab body, or one
+ * from calloc. Everything else, like scanning, flipping, growing, immortals,
+ * regions and tracing, is left to Tm_allocate_slow.
+ *
+ * These are C99 inline definitions: gc.c holds the external ones, so
+ * libtreadmill still exports Tm_allocate and Tm_allocate_flags for callers
+ * built against the old, out-of-line versions.
+ */
+inline TmObjectHeader*
+Tm_allocate_flags(TmHeap *heap, int flags)
+{
+  TmCell *cell = heap->free;
+  if((flags & TM_IMMORTAL) || heap->allocs >= heap->scan_every ||
+     TmCell_next(heap, cell) == heap->bottom || heap->region || heap->trace) {
+    return Tm_allocate_slow(heap, flags);
+  }
+
+  TmObjectHeader *header = (TmObjectHeader*)heap->slab_free;
+  if(header) {
+    heap->slab_free = *(void**)header;
+    memset(header, 0, heap->object_size);
+  } else if(heap->slab_bodies || (header = (TmObjectHeader*)calloc(1, heap->object_size)) == NULL) {
+    return Tm_allocate_slow(heap, flags);
+  }
+
+  header->cell = cell;
+  cell->value  = header;
+  cell->flags  = flags;
+  heap->free   = TmCell_next(heap, cell);
+  heap->allocs++;
+  heap->warm = 1;
+
+  return header;
+}
+
+inline TmObjectHeader*
+Tm_allocate(TmHeap *heap)
+{
+  return Tm_allocate_flags(heap, 0);
+}
+
+inline TmObjectHeader*
+Tm_allocate_hint(TmHeap *heap, int hint)
+{
+  int flags = hint & ~TM_LONG_LIVED;
+  if(hint & TM_LONG_LIVED) flags |= TM_IMMORTAL | TM_OLD;
+  return Tm_allocate_flags(heap, flags);
+}
+
 void TmHeap_print(TmHeap *heap);
 void TmHeap_print_all(TmHeap *heap);
 double TmHeap_size(TmHeap *heap);
@@ -64,9 +285,29 @@ double TmHeap_white_size(TmHeap *heap);
 double TmHeap_ecru_size(TmHeap *heap);
 double TmHeap_grey_size(TmHeap *heap);
 double TmHeap_black_size(TmHeap *heap);
+double TmHeap_immortal_size(TmHeap *heap);
+double TmHeap_pinned_size(TmHeap *heap);
+
+/*
+ * Destroying a heap releases every object still in it, walking the chunks in
+ * order rather than the ring, without collecting first.
+ *
+ * Heaps with slab_bodies set before their first allocation carve object
+ * bodies out of slabs they own instead of calling calloc, and recycle them
+ * once released. Their release function is only a finalizer, and may be
+ * NULL. Discarding such a heap frees the slabs without releasing objects one
+ * by one.
+ */
+#define TM_SLAB_BYTES (256 * 1024)
 
 void TmHeap_destroy(TmHeap* heap);
+void TmHeap_discard(TmHeap* heap);
 
-TmChunk TmChunk_new(int size);
+TmChunk* TmChunk_new(TmHeap *heap, int size);
+void TmChunk_destroy(TmChunk *chunk);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif
@@ -0,0 +1,304 @@
+#ifndef _treadmill_gc_hpp
+#define _treadmill_gc_hpp
+
+#include <cstddef>
+#include <cstdlib>
+#include <iterator>
+#include <new>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <treadmill/gc.h>
+
+/*
+ * Header-only C++ front-end (C++17).
+ *
+ *   struct Node : treadmill::object {
+ *     int value;
+ *     treadmill::gc_ptr<Node> left, right;
+ *     std::vector<treadmill::gc_ptr<Node>> children;
+ *
+ *     explicit Node(int value) : value(value) {}
+ *
+ *     static constexpr auto traced = treadmill::fields(&Node::left, &Node::right, &Node::children);
+ *   };
+ *
+ *   treadmill::heap heap(1000, 1500, 200, treadmill::size_for<Node>());
+ *   treadmill::root<Node> tree(heap, treadmill::make<Node>(heap, 1));
+ *   tree->left = treadmill::make<Node>(heap, 2);
+ *
+ * Managed types derive from treadmill::object, first and only, and have no virtual
+ * functions, so the object header stays at the start of the object. Their
+ * field lists are expanded at compile time into the scan of each type, and
+ * releasing an object runs its destructor. Types without a field list are
+ * allocated as leaves and never scanned.
+ */
+
+namespace treadmill {
+
+struct object;
+
+namespace detail {
+
+struct type_ops {
+  void (*scan)(TmHeap *heap, object *self, TmCallbackFn callback);
+  void (*destroy)(object *self);
+};
+
+struct root_link {
+  root_link *prev;
+  root_link *next;
+  object *target;
+};
+
+} // namespace detail
+
+struct object {
+  TmObjectHeader gc;
+  const detail::type_ops *ops;
+};
+
+template <typename T>
+class gc_ptr {
+public:
+  gc_ptr() noexcept : ptr_(nullptr) {}
+  gc_ptr(std::nullptr_t) noexcept : ptr_(nullptr) {}
+  explicit gc_ptr(T *ptr) noexcept : ptr_(ptr) {}
+
+  template <typename U, typename = std::enable_if_t<std::is_convertible<U*, T*>::value>>
+  gc_ptr(const gc_ptr<U> &other) noexcept : ptr_(other.get()) {}
+
+  T* get() const noexcept { return ptr_; }
+  T& operator*() const noexcept { return *ptr_; }
+  T* operator->() const noexcept { return ptr_; }
+  explicit operator bool() const noexcept { return ptr_ != nullptr; }
+
+  friend bool operator==(const gc_ptr &a, const gc_ptr &b) noexcept { return a.ptr_ == b.ptr_; }
+  friend bool operator!=(const gc_ptr &a, const gc_ptr &b) noexcept { return a.ptr_ != b.ptr_; }
+
+private:
+  T *ptr_;
+};
+
+// The list of fields holding pointers to other objects.
+template <typename... Fields>
+constexpr std::tuple<Fields...>
+fields(Fields... members)
+{
+  return std::tuple<Fields...>(members...);
+}
+
+// The object size a heap needs to hold any of the given types.
+template <typename... Ts>
+constexpr std::size_t
+size_for()
+{
+  std::size_t size = 0;
+  ((size = sizeof(Ts) > size ? sizeof(Ts) : size), ...);
+  return size;
+}
+
+namespace detail {
+
+template <typename T, typename = void>
+struct has_fields : std::false_type {};
+
+template <typename T>
+struct has_fields<T, std::void_t<decltype(T::traced)>> : std::true_type {};
+
+template <typename T>
+inline void
+trace(TmHeap *heap, const gc_ptr<T> &ptr, TmCallbackFn callback)
+{
+  if(ptr) callback(heap, &static_cast<object*>(ptr.get())->gc);
+}
+
+// Any range of traced values, like a std::vector of gc_ptrs.
+template <typename Range>
+inline auto
+trace(TmHeap *heap, const Range &range, TmCallbackFn callback)
+  -> decltype(std::begin(range), std::end(range), void())
+{
+  for(const auto &item : range) trace(heap, item, callback);
+}
+
+template <typename T>
+void
+scan(TmHeap *heap, object *self, TmCallbackFn callback)
+{
+  if constexpr (has_fields<T>::value) {
+    T *obj = static_cast<T*>(self);
+    std::apply([&](auto... field) { (trace(heap, obj->*field, callback), ...); }, T::traced);
+  }
+}
+
+template <typename T>
+void
+destroy(object *self)
+{
+  static_cast<T*>(self)->~T();
+  std::free(self);
+}
+
+template <typename T>
+struct ops_for {
+  static constexpr type_ops value = { scan<T>, destroy<T> };
+};
+
+// Objects whose constructor threw have no ops, only their memory is freed.
+inline void
+scan_pointers(TmHeap *heap, TmObjectHeader *header, TmCallbackFn callback)
+{
+  object *self = reinterpret_cast<object*>(header);
+  if(self->ops) self->ops->scan(heap, self, callback);
+}
+
+inline void
+release(void *value)
+{
+  object *self = static_cast<object*>(value);
+  if(self->ops) self->ops->destroy(self);
+  else std::free(self);
+}
+
+} // namespace detail
+
+class heap {
+public:
+  heap(int size, int growth_rate, int scan_every, std::size_t object_size)
+  {
+    roots_.prev = roots_.next = &roots_;
+    roots_.target = nullptr;
+
+    state_.header.rootset = &heap::rootset;
+    state_.owner = this;
+
+    heap_ = TmHeap_new(&state_.header, size, growth_rate, scan_every,
+        object_size, detail::release, detail::scan_pointers);
+    if(heap_ == nullptr) throw std::bad_alloc();
+  }
+
+  ~heap() { TmHeap_destroy(heap_); }
+
+  heap(const heap&) = delete;
+  heap& operator=(const heap&) = delete;
+
+  TmHeap* raw() const noexcept { return heap_; }
+  std::size_t object_size() const noexcept { return heap_->object_size; }
+
+  void scan_all() { Tm_scan_all(heap_); }
+  void flip() { Tm_flip(heap_); }
+
+private:
+  template <typename T> friend class root;
+
+  struct state {
+    TmStateHeader header;
+    heap *owner;
+  };
+
+  static Tm_DArray*
+  rootset(TmStateHeader *header)
+  {
+    heap *self = reinterpret_cast<state*>(header)->owner;
+    Tm_DArray *roots = Tm_DArray_create(sizeof(TmObjectHeader*), 16);
+
+    for(detail::root_link *link = self->roots_.next; link != &self->roots_; link = link->next) {
+      if(link->target) Tm_DArray_push(roots, &link->target->gc);
+    }
+
+    return roots;
+  }
+
+  state state_;
+  detail::root_link roots_;
+  TmHeap *heap_;
+};
+
+/*
+ * Keeps an object alive for as long as it's in scope. Roots must not outlive
+ * their heap.
+ */
+template <typename T>
+class root {
+public:
+  explicit root(heap &h, gc_ptr<T> target = nullptr) noexcept
+  {
+    link_.target = target.get();
+    attach(&h.roots_);
+  }
+
+  root(const root &other) noexcept
+  {
+    link_.target = other.link_.target;
+    attach(const_cast<detail::root_link*>(&other.link_));
+  }
+
+  ~root()
+  {
+    link_.prev->next = link_.next;
+    link_.next->prev = link_.prev;
+  }
+
+  root& operator=(const root &other) noexcept { link_.target = other.link_.target; return *this; }
+  root& operator=(gc_ptr<T> target) noexcept { link_.target = target.get(); return *this; }
+
+  T* get() const noexcept { return static_cast<T*>(link_.target); }
+  T& operator*() const noexcept { return *get(); }
+  T* operator->() const noexcept { return get(); }
+  explicit operator bool() const noexcept { return link_.target != nullptr; }
+  operator gc_ptr<T>() const noexcept { return gc_ptr<T>(get()); }
+
+private:
+  void
+  attach(detail::root_link *after) noexcept
+  {
+    link_.prev = after;
+    link_.next = after->next;
+    after->next->prev = &link_;
+    after->next = &link_;
+  }
+
+  detail::root_link link_;
+};
+
+/*
+ * Allocates a T in the heap and constructs it in place. Throws
+ * std::bad_alloc when the heap can't make room for it.
+ */
+template <typename T, typename... Args>
+gc_ptr<T>
+make(heap &h, Args&&... args)
+{
+  static_assert(std::is_base_of<object, T>::value, "Managed types must derive from treadmill::object.");
+  static_assert(!std::is_polymorphic<T>::value, "Managed types can't have virtual functions.");
+  static_assert(alignof(T) <= alignof(std::max_align_t), "Over-aligned types aren't supported.");
+
+  if(sizeof(T) > h.object_size()) throw std::length_error("Type doesn't fit in the heap's objects.");
+
+  TmObjectHeader *header = Tm_allocate_flags(h.raw(), detail::has_fields<T>::value ? 0 : TM_LEAF);
+  if(header == nullptr) throw std::bad_alloc();
+
+  // Constructing T may overwrite the header, so keep what the heap put in.
+  TmCell *cell = header->cell;
+  object *raw  = reinterpret_cast<object*>(header);
+  raw->ops = nullptr;
+
+  T *obj;
+  try {
+    obj = ::new (static_cast<void*>(header)) T(std::forward<Args>(args)...);
+  } catch(...) {
+    raw->gc.cell = cell;
+    raw->ops = nullptr;
+    throw;
+  }
+
+  obj->gc.cell = cell;
+  obj->ops = &detail::ops_for<T>::value;
+  return gc_ptr<T>(obj);
+}
+
+} // namespace treadmill
+
+#endif
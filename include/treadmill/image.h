@@ -0,0 +1,62 @@
+#ifndef _treadmill_image_h
+#define _treadmill_image_h
+
+#include <stdint.h>
+#include <treadmill/gc.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Heap images hold the live objects of a heap so another process can map
+ * them back instead of building them again:
+ *
+ *   header:  magic (u32) version (u32) object_size (u64) count (u64)
+ *            roots (u64) data (u64)
+ *   roots:   offset (u64) * roots   -- the rootset at the time of saving
+ *   flags:   flags (u8) * count     -- allocation flags of every object
+ *   ...padding up to `data`, a page boundary...
+ *   bodies:  object_size bytes * count
+ *
+ * Pointers between objects, both in the rootset and in the bodies, are
+ * stored as byte offsets from the start of the image; 0 stays NULL. Object
+ * bodies are copied verbatim otherwise, so only objects whose pointers are
+ * all reported by the heap's scan_slots function can be saved. All integers
+ * are written in host byte order.
+ */
+
+#define TM_IMAGE_MAGIC   0x4d494d54 // "TMIM"
+#define TM_IMAGE_VERSION 1
+
+// Size of the buffer the writer streams through.
+#define TM_IMAGE_BUFFER 65536
+
+typedef struct tm_image_s {
+  char *memory;
+  size_t length;
+  uint64_t data;  // offset of the first body
+  TmChunk *chunk; // cells of the loaded objects
+
+  // Only used while saving.
+  int fd;
+  int failed;
+  size_t used;
+  size_t count; // also set while loading
+  struct tm_image_entry_s *entries;
+  TmObjectHeader *object;
+  char *copy;
+  unsigned char *buffer;
+} TmImage;
+
+int TmHeap_save_image(TmHeap *heap, int fd);
+Tm_DArray* TmHeap_load_image(TmHeap *heap, int fd);
+
+// Called by TmHeap_destroy once every other object is released.
+void TmHeap_destroy_images(TmHeap *heap);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
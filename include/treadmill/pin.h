@@ -0,0 +1,40 @@
+#ifndef _treadmill_pin_h
+#define _treadmill_pin_h
+
+#include <treadmill/gc.h>
+#include <treadmill/table.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Pinning keeps an object alive whether it's reachable or not, for as long
+ * as something outside of the heap uses its memory, like a buffer handed to
+ * readv or writev. Pins nest: an object pinned twice has to be unpinned
+ * twice.
+ *
+ * Pinned objects are shaded when pinned and added to the grey area with the
+ * rootset at each flip, so they are never ecru when the flip releases
+ * garbage, and whatever they point to stays alive too. Pinning while a
+ * forked collection runs makes the parent ignore its report. Region objects
+ * can't be pinned, since they move when the region ends.
+ *
+ * The heap counts the pins of an object in its pins table, keyed by the
+ * object.
+ */
+
+int Tm_pin(TmHeap *heap, TmObjectHeader *object);
+// Returns how many pins are left on the object, or -1 if it wasn't pinned.
+int Tm_unpin(TmHeap *heap, TmObjectHeader *object);
+int Tm_pins(TmHeap *heap, TmObjectHeader *object);
+
+// Called by the collector.
+void TmHeap_scan_pins(TmHeap *heap, TmCallbackFn callback);
+void TmHeap_destroy_pins(TmHeap *heap);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
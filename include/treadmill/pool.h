@@ -0,0 +1,41 @@
+#ifndef _treadmill_pool_h
+#define _treadmill_pool_h
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Process-wide pool of chunk memory shared by every heap.
+ *
+ * Heaps map their chunks through the pool and hand them back when they are
+ * destroyed or shrunk. Returned mappings are kept idle, up to the idle
+ * limit, for the next heap that grows by about as much: a mapping up to
+ * twice the size asked for is reused rather than mapping a new one. The
+ * budget caps the memory mapped by all heaps together, idle mappings
+ * included: once it is reached, growing a heap fails instead of mapping
+ * more.
+ *
+ * The pool is protected by a mutex, so heaps living in different threads
+ * can share it.
+ */
+
+#define TM_POOL_IDLE_LIMIT (64 * 1024 * 1024)
+
+// Sets *bytes to the size of the mapping, which is what to give back.
+void* TmPool_take(size_t *bytes, int huge);
+void TmPool_give(void *memory, size_t bytes, int huge);
+
+void TmPool_set_budget(size_t bytes); // 0 means no budget
+void TmPool_set_idle_limit(size_t bytes);
+size_t TmPool_mapped(void);
+size_t TmPool_idle(void);
+void TmPool_trim(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef _treadmill_region_h
+#define _treadmill_region_h
+
+#include <treadmill/gc.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Regions are for bursts of short-lived objects, like everything a request
+ * allocates. Between Tm_region_begin and Tm_region_end, Tm_allocate bumps
+ * through blocks owned by the region instead of going through the
+ * treadmill. Region objects share a few cells of the region's own, so the
+ * collector never links, colours or releases them, and they keep whatever
+ * heap objects they point to alive like immortals do.
+ *
+ * At the end of the region, the objects reachable from the escaping ones,
+ * or from heap objects they were stored into, are copied into black cells
+ * of the heap, and every pointer to them is updated through scan_slots. The
+ * rest are dropped along with the blocks: their release function is never
+ * called, so objects that die in a region can't own memory of their own.
+ *
+ * Storing a region object into a heap object, or a heap object into a
+ * region object, must be reported to Tm_write_barrier. Immortal allocations
+ * go to the heap as usual, and regions don't nest.
+ */
+
+// Bytes bump-allocated from before the region takes another block.
+#define TM_REGION_BLOCK (64 * 1024)
+
+// The cells region objects point to.
+#define TM_REGION_OBJECT    0
+#define TM_REGION_LEAF      1
+#define TM_REGION_FORWARDED 2
+
+typedef struct tm_region_block_s {
+  struct tm_region_block_s *next;
+  size_t used;
+  size_t size;
+} TmRegionBlock;
+
+typedef struct tm_region_s {
+  TmCell cells[3];
+  TmRegionBlock *blocks;
+  size_t slot_size;
+  int allocated;
+  int survivors;
+  int failed;
+  Tm_Vec(TmObjectHeader*) remembered; // heap objects pointing into the region
+  Tm_Vec(TmObjectHeader*) promoted;   // copies whose pointers are left to update
+} TmRegion;
+
+int Tm_region_begin(TmHeap *heap);
+// Replaces the escaping objects with their copies, and returns how many
+// objects survived the region or -1 on errors.
+int Tm_region_end(TmHeap *heap, Tm_DArray *escaping);
+
+// Called by the collector while a region is active.
+TmObjectHeader* TmRegion_allocate(TmHeap *heap, int flags);
+void TmRegion_write(TmHeap *heap, TmObjectHeader *object, TmObjectHeader *value);
+void TmRegion_scan(TmHeap *heap, TmCallbackFn callback);
+void TmRegion_forget_dead(TmHeap *heap);
+void TmRegion_destroy(TmHeap *heap);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef _treadmill_site_h
+#define _treadmill_site_h
+
+#include <treadmill/gc.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Allocation sites let the heap find out which objects are long-lived by
+ * itself. Sites are small integers chosen by the program, like an enum of
+ * the places that allocate.
+ *
+ * While a site is undecided, one in TM_SITE_SAMPLE_EVERY of its objects is
+ * sampled. A sample that is still alive after TM_SITE_AGE flips counts as a
+ * survivor. Once TM_SITE_SAMPLES samples are settled, the site is
+ * pretenured if at least TM_SITE_SURVIVAL percent of them survived, and
+ * left alone for good otherwise. Pretenured sites allocate like
+ * Tm_allocate_hint with TM_LONG_LIVED from then on.
+ *
+ * Since a site can be pretenured at any point of the run, every pointer
+ * stored into an object allocated with Tm_allocate_site has to be reported
+ * to Tm_write_barrier, even while the site is young. Old objects are only
+ * scanned after such a report, so an unreported store leaves the child to
+ * be released while it's still pointed to. Leaf allocations have no
+ * pointers to report.
+ */
+#define TM_SITE_SAMPLE_EVERY 8
+#define TM_SITE_AGE          3
+#define TM_SITE_SAMPLES      32
+#define TM_SITE_SURVIVAL     90
+
+typedef enum {
+  TM_SITE_UNDECIDED = 0,
+  TM_SITE_PRETENURED,
+  TM_SITE_YOUNG
+} TmSiteState;
+
+typedef struct tm_site_s {
+  TmSiteState state;
+  int allocations;
+  int survivors;
+  int deaths;
+} TmSite;
+
+typedef struct tm_site_sample_s {
+  TmObjectHeader *object;
+  int site;
+  int flips;
+} TmSiteSample;
+
+typedef struct tm_sites_s {
+  Tm_Vec(TmSite) sites;
+  Tm_Vec(TmSiteSample) samples;
+} TmSites;
+
+TmObjectHeader* Tm_allocate_site(TmHeap *heap, int site, int flags);
+TmSite* TmHeap_site(TmHeap *heap, int site);
+
+// Called by Tm_flip once tracing is done, before ecru cells are released.
+void TmHeap_age_sites(TmHeap *heap);
+void TmHeap_destroy_sites(TmHeap *heap);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
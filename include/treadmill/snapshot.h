@@ -0,0 +1,49 @@
+#ifndef _treadmill_snapshot_h
+#define _treadmill_snapshot_h
+
+#include <stdint.h>
+#include <treadmill/gc.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Heap snapshots are a stream of records written straight to a file
+ * descriptor:
+ *
+ *   header: magic (u32) version (u32) object_size (u64)
+ *   'R' id (u64)                      -- an object in the rootset
+ *   'N' id (u64) colour (u8) size (u64) -- an object and its colour
+ *   'E' id (u64)                      -- an edge from the last 'N' record
+ *   'Z'                               -- end of snapshot
+ *
+ * Object ids are the object addresses at the time of the snapshot. All
+ * integers are written in host byte order.
+ */
+
+#define TM_SNAPSHOT_MAGIC   0x4e534d54 // "TMSN"
+#define TM_SNAPSHOT_VERSION 1
+
+#define TM_SNAPSHOT_ROOT 'R'
+#define TM_SNAPSHOT_NODE 'N'
+#define TM_SNAPSHOT_EDGE 'E'
+#define TM_SNAPSHOT_END  'Z'
+
+// Size of the buffer the writer streams through.
+#define TM_SNAPSHOT_BUFFER 65536
+
+typedef enum {
+  TM_WHITE = 0,
+  TM_ECRU,
+  TM_GREY,
+  TM_BLACK
+} TmColour;
+
+int TmHeap_snapshot(TmHeap *heap, int fd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef _treadmill_table_h
+#define _treadmill_table_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Open addressing table keyed by address, for the parts of the collector
+ * that keep something on the side for some objects. Removing an entry
+ * leaves a tombstone so probes carry on past it, until the table is resized.
+ * A table zeroed with calloc is empty and grows on the first insertion.
+ */
+
+#define TM_TABLE_MIN 8
+
+// Marks a slot whose entry was removed.
+#define TM_TABLE_TOMBSTONE ((void*)1)
+
+typedef struct tm_table_s {
+  void **keys;
+  void **values;
+  int capacity; // a power of two, or 0 before the first insertion
+  int count;
+  int used;     // live entries plus tombstones
+} TmTable;
+
+#define TmTable_live(T, I) ((T)->keys[(I)] && (T)->keys[(I)] != TM_TABLE_TOMBSTONE)
+
+// Makes room for `count` entries up front.
+int TmTable_init(TmTable *table, int count);
+// Returns the slot holding key, or -1.
+int TmTable_find(TmTable *table, const void *key);
+// Returns the slot holding key, adding it with a NULL value if needed, or -1
+// if the table couldn't grow.
+int TmTable_insert(TmTable *table, void *key);
+void* TmTable_get(TmTable *table, const void *key);
+void TmTable_remove_at(TmTable *table, int slot);
+void TmTable_free(TmTable *table);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef _treadmill_trace_h
+#define _treadmill_trace_h
+
+#include <stdint.h>
+#include <treadmill/gc.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Allocation traces record what a program does to its heap so the same
+ * workload can be replayed offline against other settings:
+ *
+ *   header: magic (u32) version (u32) object_size (u64)
+ *   'A' flags                 -- an allocation, objects are numbered from 1
+ *   'W' object field value    -- a pointer write reported to the barrier
+ *   'F'                       -- a flip
+ *   'R' count id * count      -- the rootset taken by that flip
+ *   'X' id                    -- an object released by the collector
+ *   'Z'                       -- end of trace
+ *
+ * Tags are one byte, every other value is an unsigned LEB128 varint. Object
+ * numbers replace addresses, so traces are identical from run to run, and 0
+ * stands for NULL or for an object the trace doesn't know about. Objects
+ * already in the heap when recording starts are recorded as allocations,
+ * followed by a write for each of their pointers.
+ *
+ * Region objects are recorded like any other allocation. Those that survive
+ * the region keep their number when they're copied into the heap, and the
+ * others are recorded as released when the region ends.
+ */
+
+#define TM_TRACE_MAGIC   0x52544d54 // "TMTR"
+#define TM_TRACE_VERSION 1
+
+#define TM_TRACE_ALLOCATE 'A'
+#define TM_TRACE_WRITE    'W'
+#define TM_TRACE_FLIP     'F'
+#define TM_TRACE_ROOTS    'R'
+#define TM_TRACE_RELEASE  'X'
+#define TM_TRACE_END      'Z'
+
+// Size of the buffer the recorder streams through.
+#define TM_TRACE_BUFFER 65536
+
+int TmTrace_start(TmHeap *heap, int fd);
+int TmTrace_stop(TmHeap *heap);
+
+// Called by the collector while a trace is being recorded.
+void TmTrace_allocate(TmHeap *heap, TmObjectHeader *object, int flags);
+void TmTrace_promote(TmHeap *heap, TmObjectHeader *object, TmObjectHeader *copy, int flags);
+void TmTrace_write(TmHeap *heap, TmObjectHeader *object, uintptr_t field, TmObjectHeader *value);
+void TmTrace_flip(TmHeap *heap);
+void TmTrace_roots(TmHeap *heap, Tm_DArray *rootset);
+void TmTrace_release(TmHeap *heap, void *value);
+
+typedef struct tm_trace_event_s {
+  unsigned char type;
+  int flags;         // 'A'
+  uint64_t object;   // 'A' (the new number), 'W' and 'X'
+  uint64_t field;    // 'W'
+  uint64_t value;    // 'W'
+  uint64_t count;    // 'R'
+  uint64_t *roots;   // 'R', valid until the next event is read
+} TmTraceEvent;
+
+typedef struct tm_trace_reader_s TmTraceReader;
+
+TmTraceReader* TmTraceReader_open(int fd);
+uint64_t TmTraceReader_object_size(TmTraceReader *reader);
+// Returns 1 with the next event, 0 at the end of the trace and -1 on errors.
+int TmTraceReader_next(TmTraceReader *reader, TmTraceEvent *event);
+void TmTraceReader_close(TmTraceReader *reader);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef _treadmill_weak_h
+#define _treadmill_weak_h
+
+#include <treadmill/gc.h>
+#include <treadmill/table.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Weak references don't keep their target alive. When a flip finds the
+ * target still ecru, i.e. unreachable, the reference is cleared before the
+ * target is released.
+ *
+ * Weak tables map objects to arbitrary values without keeping the keys
+ * alive: entries whose key is collected are dropped at the same point.
+ * Values are not traced, so a value that must stay alive has to be reachable
+ * some other way.
+ *
+ * Both are registered with the heap, so clearing costs one check per
+ * reference or table slot, independently of the size of the heap. Whatever
+ * is still registered when the heap is destroyed is freed along with it.
+ * Region objects can't be referenced weakly, since they move or vanish when
+ * the region ends.
+ */
+
+typedef struct tm_weak_ref_s {
+  TmObjectHeader *target;
+  struct tm_weak_ref_s *next;
+  struct tm_weak_ref_s *prev;
+} TmWeakRef;
+
+typedef struct tm_weak_table_s {
+  TmTable entries;
+  struct tm_weak_table_s *next;
+  struct tm_weak_table_s *prev;
+} TmWeakTable;
+
+TmWeakRef* TmWeakRef_new(TmHeap *heap, TmObjectHeader *target);
+TmObjectHeader* TmWeakRef_get(TmHeap *heap, TmWeakRef *ref);
+void TmWeakRef_destroy(TmHeap *heap, TmWeakRef *ref);
+
+TmWeakTable* TmWeakTable_new(TmHeap *heap, int capacity);
+int TmWeakTable_put(TmWeakTable *table, TmObjectHeader *key, void *value);
+void* TmWeakTable_get(TmWeakTable *table, TmObjectHeader *key);
+void* TmWeakTable_remove(TmWeakTable *table, TmObjectHeader *key);
+void TmWeakTable_destroy(TmHeap *heap, TmWeakTable *table);
+
+#define TmWeakTable_count(T) ((T)->entries.count)
+
+// Called by Tm_flip once tracing is done, before ecru cells are released.
+void TmHeap_clear_weak(TmHeap *heap);
+void TmHeap_destroy_weak(TmHeap *heap);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,160 @@
+#include <stdint.h>
+#include <treadmill/cards.h>
+
+#define CARDS_FOR(S) (((S) + TM_CARD_BYTES - 1) / TM_CARD_BYTES)
+
+TmCards*
+TmHeap_cards(TmHeap *heap, TmObjectHeader *object)
+{
+  return heap->cards ? TmTable_get(heap->cards, object) : NULL;
+}
+
+/*
+ * The object may have been scanned already, but its cards can't tell what
+ * was stored into it before, so it's scanned whole once more.
+ */
+int
+TmHeap_track_cards(TmHeap *heap, TmObjectHeader *object, size_t size)
+{
+  TmCell *cell = object->cell;
+  check(!(cell->flags & (TM_LEAF | TM_IMMORTAL | TM_OLD | TM_REGION)),
+    "Leaves, immortals and region objects can't be tracked.");
+
+  if(heap->cards == NULL) {
+    heap->cards = calloc(1, sizeof(TmTable));
+    check_mem(heap->cards);
+  }
+
+  TmTable *table = heap->cards;
+  int i = TmTable_find(table, object);
+
+  if(i >= 0) {
+    TmCards *cards = table->values[i];
+    size_t before = CARDS_FOR(cards->size);
+    size_t after  = CARDS_FOR(size);
+
+    if(after != before) {
+      TmCards *resized = realloc(cards, sizeof(TmCards) + after);
+      check_mem(resized);
+      if(after > before) memset(resized->marks + before, 0, after - before);
+      table->values[i] = cards = resized;
+    }
+    cards->size = size;
+
+    // Dirty cards past the new end don't need scanning anymore.
+    cards->dirty = 0;
+    for(size_t j=0; j < after; j++) cards->dirty += cards->marks[j];
+    return 0;
+  }
+
+  TmCards *cards = calloc(1, sizeof(TmCards) + CARDS_FOR(size));
+  check_mem(cards);
+  cards->object = object;
+  cards->size   = size;
+
+  i = TmTable_insert(table, object);
+  if(i < 0) {
+    free(cards);
+    sentinel("Failed to grow the card table.");
+  }
+  table->values[i] = cards;
+
+  cell->flags |= TM_CARDS;
+  Tm_rescan(heap, object);
+  return 0;
+
+error:
+  return -1;
+}
+
+/*
+ * Returns whether the object has to go back to the grey area, i.e. it was
+ * scanned and nothing is pending on it yet.
+ */
+int
+TmCards_mark(TmCards *cards, uintptr_t field)
+{
+  // Otherwise it will be scanned whole anyway.
+  if(!cards->scanned) return 0;
+
+  int clean = cards->dirty == 0;
+  if(field >= cards->size) {
+    // There's no card for it, so the whole object is scanned again.
+    cards->scanned = 0;
+    return clean;
+  }
+
+  size_t card = field / TM_CARD_BYTES;
+  if(cards->marks[card]) return 0;
+
+  cards->marks[card] = 1;
+  cards->dirty++;
+  return clean;
+}
+
+void
+TmCards_scan(TmHeap *heap, TmCards *cards, TmCallbackFn callback)
+{
+  size_t count = CARDS_FOR(cards->size);
+
+  if(!cards->scanned || heap->scan_range == NULL) {
+    heap->scan_pointers(heap, cards->object, callback);
+    if(cards->dirty) memset(cards->marks, 0, count);
+    cards->dirty = 0;
+    cards->scanned = 1;
+    return;
+  }
+
+  // Runs of dirty cards are scanned in one call.
+  for(size_t i=0; i < count && cards->dirty > 0; i++) {
+    if(!cards->marks[i]) continue;
+
+    size_t from = i;
+    while(i < count && cards->marks[i]) {
+      cards->marks[i++] = 0;
+      cards->dirty--;
+    }
+
+    size_t to = i * TM_CARD_BYTES;
+    heap->scan_range(heap, cards->object, from * TM_CARD_BYTES,
+      to < cards->size ? to : cards->size, callback);
+  }
+}
+
+void
+TmHeap_forget_cards(TmHeap *heap, TmObjectHeader *object)
+{
+  TmTable *table = heap->cards;
+  int i = table ? TmTable_find(table, object) : -1;
+  if(i < 0) return;
+
+  free(table->values[i]);
+  TmTable_remove_at(table, i);
+}
+
+// Black objects turn ecru at a flip, and are scanned whole when reached.
+void
+TmHeap_reset_cards(TmHeap *heap)
+{
+  TmTable *table = heap->cards;
+  if(table == NULL) return;
+
+  for(int i=0; i < table->capacity; i++) {
+    if(TmTable_live(table, i)) ((TmCards*)table->values[i])->scanned = 0;
+  }
+}
+
+void
+TmHeap_destroy_cards(TmHeap *heap)
+{
+  TmTable *table = heap->cards;
+  if(table == NULL) return;
+
+  for(int i=0; i < table->capacity; i++) {
+    if(TmTable_live(table, i)) free(table->values[i]);
+  }
+
+  TmTable_free(table);
+  free(table);
+  heap->cards = NULL;
+}
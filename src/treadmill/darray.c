@@ -8,8 +8,13 @@ Tm_DArray *Tm_DArray_create(size_t element_size, size_t initial_max)
   array->max = initial_max;
   check(array->max > 0, "You must set an initial_max > 0.");
 
-  array->contents = calloc(initial_max, sizeof(void *));
-  check_mem(array->contents);
+  if(initial_max <= TM_DARRAY_SMALL) {
+    array->contents = array->small;
+    memset(array->small, 0, sizeof(array->small));
+  } else {
+    array->contents = calloc(initial_max, sizeof(void *));
+    check_mem(array->contents);
+  }
 
   array->end = 0;
   array->element_size = element_size;
@@ -36,29 +41,45 @@ void Tm_DArray_clear(Tm_DArray *array)
 
 static inline int Tm_DArray_resize(Tm_DArray *array, size_t newsize)
 {
-  array->max = newsize;
-  check(array->max > 0, "The newsize must be > 0.");
+  check(newsize > 0, "The newsize must be > 0.");
+  void *contents = NULL;
 
-  void *contents = realloc(array->contents, array->max * sizeof(void *));
-  // check contents and assume realloc doesn't harm the original on error
-
-  check_mem(contents);
+  if(array->contents == array->small) {
+    if(newsize <= TM_DARRAY_SMALL) {
+      array->max = newsize;
+      return 0;
+    }
+    contents = malloc(newsize * sizeof(void *));
+    check_mem(contents);
+    memcpy(contents, array->small, array->max * sizeof(void *));
+  } else if(newsize <= TM_DARRAY_SMALL) {
+    memcpy(array->small, array->contents, newsize * sizeof(void *));
+    free(array->contents);
+    contents = array->small;
+  } else {
+    contents = realloc(array->contents, newsize * sizeof(void *));
+    // check contents and assume realloc doesn't harm the original on error
+    check_mem(contents);
+  }
 
   array->contents = contents;
+  array->max = newsize;
 
   return 0;
 error:
   return -1;
 }
 
+// Grows by the current size, so pushing n elements costs O(log n) copies.
 int Tm_DArray_expand(Tm_DArray *array)
 {
   size_t old_max = array->max;
-  check(Tm_DArray_resize(array, array->max + array->expand_rate) == 0,
-    "Failed to expand array to new size: %d",
-    array->max + (int)array->expand_rate);
+  size_t growth = old_max > array->expand_rate ? old_max : array->expand_rate;
+
+  check(Tm_DArray_resize(array, old_max + growth) == 0,
+    "Failed to expand array to new size: %d", (int)(old_max + growth));
 
-  memset(array->contents + old_max, 0, array->expand_rate + 1);
+  memset(array->contents + old_max, 0, growth * sizeof(void *));
   return 0;
 
 error:
@@ -75,7 +96,7 @@ int Tm_DArray_contract(Tm_DArray *array)
 void Tm_DArray_destroy(Tm_DArray *array)
 {
   if(array) {
-    if(array->contents) free(array->contents);
+    if(array->contents && array->contents != array->small) free(array->contents);
     free(array);
   }
 }
@@ -105,8 +126,10 @@ void *Tm_DArray_pop(Tm_DArray *array)
   void *el = Tm_DArray_remove(array, array->end - 1);
   array->end--;
 
-  if (Tm_DArray_end(array) > (int)array->expand_rate && Tm_DArray_end(array) % array->expand_rate) {
-    Tm_DArray_contract(array);
+  // Halving at a quarter full leaves the array half full, so the next
+  // pushes don't have to grow it right back.
+  if(array->end < array->max / 4 && array->max / 2 > (int)array->expand_rate) {
+    Tm_DArray_resize(array, array->max / 2);
   }
 
   return el;
@@ -122,3 +145,21 @@ error:
   return;
 }
 
+int Tm_Vec_grow(void *contents, int *max, size_t element_size)
+{
+  void *old = NULL;
+  int new_max = *max < TM_VEC_MIN ? TM_VEC_MIN : *max * 2;
+
+  // The element pointer is copied in and out rather than cast, since its
+  // type depends on the vector.
+  memcpy(&old, contents, sizeof(void *));
+  void *grown = realloc(old, new_max * element_size);
+  check_mem(grown);
+  memcpy(contents, &grown, sizeof(void *));
+
+  *max = new_max;
+  return 0;
+
+error:
+  return -1;
+}
@@ -0,0 +1,173 @@
+#define _POSIX_C_SOURCE 200809L
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <treadmill/fork.h>
+
+static int
+write_all(int fd, const void *data, size_t size)
+{
+  size_t done = 0;
+
+  while(done < size) {
+    ssize_t written = write(fd, (const char*)data + done, size - done);
+    if(written < 0) return -1;
+    done += written;
+  }
+
+  return 0;
+}
+
+/*
+ * Runs in the child, which only has the thread that forked: it doesn't
+ * allocate, and leaves without running atexit handlers.
+ */
+static void
+report_dead(TmHeap *heap, Tm_DArray *rootset, TmForkTraceFn trace, int fd)
+{
+  TmObjectHeader *batch[TM_FORK_BATCH];
+  int count = 0;
+
+  trace(heap, rootset);
+
+  for(TmCell *ptr = heap->bottom; ptr != heap->top; ptr = TmCell_next(heap, ptr)) {
+    batch[count++] = ptr->value;
+
+    if(count == TM_FORK_BATCH) {
+      if(write_all(fd, batch, sizeof(batch)) != 0) _exit(1);
+      count = 0;
+    }
+  }
+
+  if(write_all(fd, batch, count * sizeof(TmObjectHeader*)) != 0) _exit(1);
+  _exit(0);
+}
+
+int
+TmFork_start(TmHeap *heap, Tm_DArray *rootset, TmForkTraceFn trace)
+{
+  int fds[2] = { -1, -1 };
+  TmFork *child = NULL;
+
+  check(heap->fork == NULL, "A forked collection is running already.");
+  check(pipe(fds) == 0, "Couldn't create a pipe for a forked collection.");
+
+  child = calloc(1, sizeof(TmFork));
+  check_mem(child);
+
+  int pid = fork();
+  check(pid >= 0, "Couldn't fork a collection.");
+
+  if(pid == 0) {
+    close(fds[0]);
+    report_dead(heap, rootset, trace, fds[1]);
+  }
+
+  close(fds[1]);
+  fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+
+  debug("[GC] Forked collection %i", pid);
+  child->pid = pid;
+  child->fd  = fds[0];
+  heap->fork = child;
+  return 0;
+
+error:
+  if(fds[0] >= 0) close(fds[0]);
+  if(fds[1] >= 0) close(fds[1]);
+  if(child) free(child);
+  return -1;
+}
+
+static void
+end(TmHeap *heap)
+{
+  TmFork *child = heap->fork;
+  int status = 0;
+
+  if(child->fd >= 0) close(child->fd);
+  waitpid(child->pid, &status, 0);
+  if(!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    log_warn("Forked collection %i failed, some garbage is left for later.", child->pid);
+  }
+
+  Tm_Vec_free(&child->dead);
+  free(child);
+  heap->fork = NULL;
+}
+
+/*
+ * Returns 0 once the child closed the pipe, or the pipe broke: what was read
+ * is still dead, the rest is left for the next child.
+ */
+static int
+drain(TmHeap *heap, int wait)
+{
+  TmFork *child = heap->fork;
+  if(wait) fcntl(child->fd, F_SETFL, fcntl(child->fd, F_GETFL) & ~O_NONBLOCK);
+
+  for(;;) {
+    ssize_t got = read(child->fd, (char*)child->batch + child->used, sizeof(child->batch) - child->used);
+    if(got == 0) return 0;
+    if(got < 0) {
+      if(errno == EINTR) continue;
+      if(!wait && (errno == EAGAIN || errno == EWOULDBLOCK)) return 1;
+      log_err("Failed to read from forked collection %i.", child->pid);
+      return 0;
+    }
+
+    child->used += got;
+    size_t count = child->used / sizeof(TmObjectHeader*);
+    for(size_t i=0; i < count && !child->stale; i++) {
+      // Without room for the whole report, none of it is used.
+      if(Tm_Vec_push(&child->dead, child->batch[i]) != 0) child->stale = 1;
+    }
+
+    // A pointer may be split across reads.
+    size_t left = child->used - count * sizeof(TmObjectHeader*);
+    memmove(child->batch, (char*)child->batch + count * sizeof(TmObjectHeader*), left);
+    child->used = left;
+  }
+}
+
+void
+TmFork_poll(TmHeap *heap)
+{
+  if(heap->fork && drain(heap, 0) == 0) {
+    // Nothing left to read, but the child may still be exiting.
+    TmFork *child = heap->fork;
+    close(child->fd);
+    child->fd = -1;
+  }
+}
+
+void
+TmFork_finish(TmHeap *heap, TmCallbackFn condemn)
+{
+  TmFork *child = heap->fork;
+  if(child == NULL) return;
+  if(child->fd >= 0) drain(heap, 1);
+
+  if(child->stale) {
+    debug("[GC] Forked collection %i is stale, something was pinned since", child->pid);
+  } else {
+    debug("[GC] Forked collection %i found %i dead objects", child->pid, Tm_Vec_count(&child->dead));
+    for(int i=0; i < Tm_Vec_count(&child->dead); i++) {
+      condemn(heap, Tm_Vec_at(&child->dead, i));
+    }
+  }
+
+  end(heap);
+}
+
+// The child's findings are stale once the heap is gone.
+void
+TmFork_destroy(TmHeap *heap)
+{
+  TmFork *child = heap->fork;
+  if(child == NULL) return;
+
+  kill(child->pid, SIGKILL);
+  end(heap);
+}
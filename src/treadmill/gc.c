@@ -1,5 +1,35 @@
+#define _DEFAULT_SOURCE
 #include <stdlib.h>
+#include <stdint.h>
+#include <sys/mman.h>
 #include <treadmill/gc.h>
+#include <treadmill/weak.h>
+#include <treadmill/image.h>
+#include <treadmill/pool.h>
+#include <treadmill/trace.h>
+#include <treadmill/region.h>
+#include <treadmill/cards.h>
+#include <treadmill/pin.h>
+#include <treadmill/site.h>
+#include <treadmill/fork.h>
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
+// Cells linked into the ring at once when the white area runs out.
+#define TM_LINK_BATCH 2048
+
+#define TM_PAGE_SIZE      4096
+#define TM_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+#ifdef TM_COMPACT_CELLS
+#define TM_ARENA_BYTES ((size_t)TM_MAX_CELLS * sizeof(TmCell))
+#endif
 
 #define BOTTOM  heap->bottom
 #define TOP     heap->top
@@ -7,28 +37,116 @@
 #define FREE    heap->free
 #define RELEASE heap->release
 
+#define NEXT(C)        TmCell_next(heap, (C))
+#define PREV(C)        TmCell_prev(heap, (C))
+#define SET_NEXT(C, N) TmCell_set_next(heap, (C), (N))
+#define SET_PREV(C, P) TmCell_set_prev(heap, (C), (P))
+
 #define ITERATE(A, B, N) \
   (N) = (A);             \
   while((N) != (B))
 
+/*
+ * The treadmill walks chase pointers through cells scattered across chunks,
+ * so they keep a cursor TM_PREFETCH_DISTANCE cells ahead of the one being
+ * processed and prefetch it (and, where the walk needs it, its object).
+ */
+#ifdef TM_NO_PREFETCH
+#define TM_PREFETCH_DISTANCE 0
+#define TM_PREFETCH(A)
+#else
+#define TM_PREFETCH_DISTANCE 8
+#if defined(__GNUC__) || defined(__clang__)
+#define TM_PREFETCH(A) __builtin_prefetch((A))
+#else
+#define TM_PREFETCH(A)
+#endif
+#endif
+
+/*
+ * Object bodies carved out of heap-owned slabs. Released bodies are kept in
+ * a free list threaded through their first word.
+ */
+typedef struct tm_slab_s {
+  struct tm_slab_s *next;
+  size_t used;
+  size_t size;
+} TmSlab;
+
+// Bodies are aligned like malloc's.
+#define TM_BODY_ALIGN 16
+#define TM_SLAB_HEADER ((sizeof(TmSlab) + TM_BODY_ALIGN - 1) & ~(size_t)(TM_BODY_ALIGN - 1))
+
+static inline size_t
+body_size(TmHeap *heap)
+{
+  size_t size = heap->object_size < sizeof(void*) ? sizeof(void*) : heap->object_size;
+  return (size + TM_BODY_ALIGN - 1) & ~(size_t)(TM_BODY_ALIGN - 1);
+}
+
+static void*
+slab_body(TmHeap *heap)
+{
+  void *body = heap->slab_free;
+  size_t size = body_size(heap);
+
+  if(body) {
+    heap->slab_free = *(void**)body;
+  } else {
+    TmSlab *slab = heap->slabs;
+
+    if(slab == NULL || slab->used + size > slab->size) {
+      size_t bytes = TM_SLAB_BYTES > TM_SLAB_HEADER + size ? TM_SLAB_BYTES : TM_SLAB_HEADER + size;
+      slab = malloc(bytes);
+      if(slab == NULL) return NULL;
+
+      slab->next  = heap->slabs;
+      slab->used  = TM_SLAB_HEADER;
+      slab->size  = bytes;
+      heap->slabs = slab;
+    }
+
+    body = (char*)slab + slab->used;
+    slab->used += size;
+  }
+
+  memset(body, 0, heap->object_size);
+  return body;
+}
+
+static inline TmObjectHeader*
+new_body(TmHeap *heap)
+{
+  return heap->slab_bodies ? slab_body(heap) : calloc(1, heap->object_size);
+}
+
+static inline void
+release_body(TmHeap *heap, void *value)
+{
+  if(RELEASE) RELEASE(value);
+
+  if(heap->slab_bodies) {
+    *(void**)value = heap->slab_free;
+    heap->slab_free = value;
+  }
+}
+
 /*
  * -(bottom)- ECRU -(top)- GREY -(scan)- BLACK -(free)- WHITE ...
  */
 
 static inline void
 unsnap(TmHeap *heap, TmCell* self) {
-  TmCell *my_prev = self->prev;
-  TmCell *my_next = self->next;
-  self->next = NULL;
-  self->prev = NULL;
+  TmCell *my_prev = PREV(self);
+  TmCell *my_next = NEXT(self);
 
   if(BOTTOM == self) BOTTOM = my_next;
   if(TOP    == self) TOP    = my_next;
   if(SCAN   == self) SCAN   = my_next;
   if(FREE   == self) FREE   = my_next;
 
-  my_prev->next = my_next;
-  my_next->prev = my_prev;
+  SET_NEXT(my_prev, my_next);
+  SET_PREV(my_next, my_prev);
 }
 
 static inline void
@@ -37,13 +155,13 @@ insert_in(TmHeap *heap, TmCell* self, TmCell* him) {
 
   unsnap(heap, self);
 
-  TmCell *his_prev = him->prev;
+  TmCell *his_prev = PREV(him);
 
-  his_prev->next = self;
-  him->prev      = self;
+  SET_NEXT(his_prev, self);
+  SET_PREV(him, self);
 
-  self->prev  = his_prev;
-  self->next  = him;
+  SET_PREV(self, his_prev);
+  SET_NEXT(self, him);
 
   if(him == TOP)    TOP = self;
   if(him == BOTTOM) BOTTOM = self;
@@ -55,9 +173,9 @@ static inline void
 make_ecru(TmHeap *heap, TmCell *self)
 {
   if(self == BOTTOM) {
-    if (self == TOP)  TOP  = self->next;
-    if (self == SCAN) SCAN = self->next;
-    if (self == FREE) FREE = self->next;
+    if (self == TOP)  TOP  = NEXT(self);
+    if (self == SCAN) SCAN = NEXT(self);
+    if (self == FREE) FREE = NEXT(self);
   } else {
     insert_in(heap, self, BOTTOM);
   }
@@ -71,10 +189,105 @@ make_grey(TmHeap *heap, TmCell *self)
   self->ecru = 0;
 
   if (self == SCAN) {
-    SCAN = self->next;
+    SCAN = NEXT(self);
   }
   if (self == FREE) {
-    FREE = self->next;
+    FREE = NEXT(self);
+  }
+}
+
+/*
+ * Moves a reachable cell right before SCAN, making it the first black cell
+ * without going through the grey area.
+ */
+static inline void
+make_black(TmHeap *heap, TmCell *self)
+{
+  self->ecru = 0;
+  if(self == SCAN) return;
+
+  unsnap(heap, self);
+
+  TmCell *him      = SCAN;
+  TmCell *his_prev = PREV(him);
+
+  SET_NEXT(his_prev, self);
+  SET_PREV(him, self);
+  SET_PREV(self, his_prev);
+  SET_NEXT(self, him);
+
+  if(him == BOTTOM) BOTTOM = self;
+  if(him == TOP)    TOP    = self;
+  SCAN = self;
+}
+
+static inline void
+make_reachable(TmHeap *heap, TmCell *self)
+{
+  if(self->flags & TM_LEAF) {
+    make_black(heap, self);
+  } else {
+    make_grey(heap, self);
+  }
+}
+
+// Links a cell that isn't part of the treadmill into the ring of immortals.
+static inline void
+link_immortal(TmHeap *heap, TmCell *self)
+{
+  self->ecru = 0;
+
+  TmCell *head = heap->immortal;
+  if(head == NULL) {
+    SET_NEXT(self, self);
+    SET_PREV(self, self);
+    heap->immortal = self;
+  } else {
+    TmCell *last = PREV(head);
+    SET_NEXT(last, self);
+    SET_PREV(self, last);
+    SET_NEXT(self, head);
+    SET_PREV(head, self);
+  }
+
+  heap->immortals++;
+}
+
+// Takes a cell out of the treadmill for good.
+static inline void
+make_immortal(TmHeap *heap, TmCell *self)
+{
+  unsnap(heap, self);
+  link_immortal(heap, self);
+}
+
+// Moves an immortal cell back into the treadmill, as the first black cell.
+static inline void
+make_mortal(TmHeap *heap, TmCell *self)
+{
+  TmCell *my_prev = PREV(self);
+  TmCell *my_next = NEXT(self);
+
+  if(heap->immortal == self) heap->immortal = my_next == self ? NULL : my_next;
+  SET_NEXT(my_prev, my_next);
+  SET_PREV(my_next, my_prev);
+  heap->immortals--;
+
+  SET_NEXT(self, self);
+  SET_PREV(self, self);
+  self->flags &= ~TM_IMMORTAL;
+  make_black(heap, self);
+}
+
+static inline void
+scan_cell(TmHeap *heap, TmCell *cell, TmCallbackFn callback)
+{
+  if(cell->flags & TM_LEAF) return;
+
+  if(cell->flags & TM_CARDS) {
+    TmCards_scan(heap, TmHeap_cards(heap, cell->value), callback);
+  } else {
+    heap->scan_pointers(heap, cell->value, callback);
   }
 }
 
@@ -90,16 +303,11 @@ TmHeap_new(
   TmScanPointersFn scan_pointers_fn)
 {
   TmHeap *heap = calloc(1, sizeof(TmHeap));
+  check_mem(heap);
 
   heap->state  = state;
-  heap->chunks = Tm_DArray_create(sizeof(TmCell*), 100);
-
-  TmChunk chunk = TmChunk_new(size + 1);
-  TmCell *head = chunk.head;
-  TmCell *tail = chunk.tail;
-
-  // Save a reference to the chunk to deallocate it later
-  Tm_DArray_push(heap->chunks, head);
+  heap->chunks = Tm_DArray_create(sizeof(TmChunk*), 100);
+  check_mem(heap->chunks);
 
   heap->growth_rate   = growth_rate;
   heap->release       = release_fn;
@@ -109,28 +317,39 @@ TmHeap_new(
   heap->allocs        = 0;
   heap->scan_every    = scan_every;
 
-  FREE   = head;
-  BOTTOM = head;
-  TOP    = head;
-  SCAN   = head;
+  TmHeap_grow(heap, size + 1);
 
-  // Close the circle.
-  tail->next = head;
-  head->prev = tail;
+  // The ring needs at least one cell, the rest can wait in the reserve.
+  check(TmHeap_link(heap, 1) == 1, "Failed to create a heap of %i cells.", size);
 
   return heap;
+
+error:
+  if(heap && heap->chunks) {
+    for(int i=0; i < Tm_DArray_count(heap->chunks); i++) {
+      TmChunk_destroy((TmChunk*)Tm_DArray_at(heap->chunks, i));
+    }
+    Tm_DArray_destroy(heap->chunks);
+  }
+#ifdef TM_COMPACT_CELLS
+  if(heap && heap->cells) munmap(heap->cells, TM_ARENA_BYTES);
+#endif
+  if(heap) free(heap);
+  return NULL;
 }
 
 void
 TmHeap_print(TmHeap *heap)
 {
   printf(
-    "[HEAP] (%i) (ECRU %i | GREY %i | BLACK %i | WHITE %i)\n",
+    "[HEAP] (%i) (ECRU %i | GREY %i | BLACK %i | WHITE %i) (IMMORTAL %i) (PINNED %i)\n",
     (int)TmHeap_size(heap),
     (int)TmHeap_ecru_size(heap),
     (int)TmHeap_grey_size(heap),
     (int)TmHeap_black_size(heap),
-    (int)TmHeap_white_size(heap)
+    (int)TmHeap_white_size(heap),
+    (int)TmHeap_immortal_size(heap),
+    (int)TmHeap_pinned_size(heap)
     );
 }
 
@@ -147,46 +366,218 @@ TmHeap_print_all(TmHeap *heap)
     if(ptr == FREE) printf(" (FREE)");
     if(ptr == SCAN) printf(" (SCAN)");
     printf("\n");
-  } while((ptr = ptr->next) && ptr != TOP);
+  } while((ptr = NEXT(ptr)) != TOP);
   printf("[END HEAP]\n");
 }
 
 void
 TmHeap_grow(TmHeap *heap, int size)
 {
+  if(heap->max_size && heap->capacity + size > heap->max_size) {
+    size = heap->max_size - heap->capacity;
+  }
   if(size < 1) return;
 
-  TmChunk chunk = TmChunk_new(size);
-  TmCell *head = chunk.head;
-  TmCell *tail = chunk.tail;
+  TmChunk *chunk = TmChunk_new(heap, size);
+  check(chunk, "Failed to grow the heap by %i cells.", size);
+
+  // Save a reference to the chunk to deallocate it later. Its cells will be
+  // linked into the ring on demand.
+  Tm_DArray_push(heap->chunks, chunk);
+  heap->reserve  += size;
+  heap->capacity += size;
+
+error:
+  return;
+}
+
+int
+TmHeap_link(TmHeap *heap, int count)
+{
+  if(heap->reserve == 0) return 0;
+
+  TmChunk *chunk = Tm_DArray_at(heap->chunks, heap->pending);
+  int available  = chunk->size - chunk->linked;
+  if(count > available) count = available;
+
+  TmCell *head = chunk->cells + chunk->linked;
+  TmCell *tail = head + count - 1;
 
-  // Save a reference to the chunk to deallocate it later
-  Tm_DArray_push(heap->chunks, head);
+  // Pooled chunk memory may still hold the cells of another heap.
+  for(TmCell *ptr = head; ptr <= tail; ptr++) {
+    ptr->value = NULL;
+    ptr->ecru  = 0;
+    ptr->flags = 0;
+    if(ptr == tail) break;
 
-  // Put the new chunk before the current free.
+    SET_NEXT(ptr, ptr + 1);
+    SET_PREV(ptr + 1, ptr);
+  }
+
+  chunk->linked += count;
+  heap->reserve -= count;
+  if(chunk->linked == chunk->size) heap->pending++;
+
+  if(FREE == NULL) {
+    // Close the circle.
+    SET_NEXT(tail, head);
+    SET_PREV(head, tail);
+
+    FREE   = head;
+    BOTTOM = head;
+    TOP    = head;
+    SCAN   = head;
+    return count;
+  }
+
+  // Put the new cells before the current free.
   TmCell *oldfree  = FREE;
-  TmCell *previous = oldfree->prev;
+  TmCell *previous = PREV(oldfree);
 
   // Attach tail
-  oldfree->prev = tail;
-  tail->next    = oldfree;
+  SET_PREV(oldfree, tail);
+  SET_NEXT(tail, oldfree);
 
   // Attach head
-  previous->next = head;
-  head->prev     = previous;
+  SET_NEXT(previous, head);
+  SET_PREV(head, previous);
 
   if(BOTTOM == FREE) BOTTOM = head;
   if(TOP    == FREE) TOP = head;
   if(SCAN   == FREE) SCAN = head;
   FREE = head;
+
+  return count;
+}
+
+#ifndef TM_COMPACT_CELLS
+typedef struct tm_chunk_range_s {
+  TmCell *cells;
+  int index;
+} TmChunkRange;
+
+static int
+compare_ranges(const void *a, const void *b)
+{
+  uintptr_t x = (uintptr_t)((const TmChunkRange*)a)->cells;
+  uintptr_t y = (uintptr_t)((const TmChunkRange*)b)->cells;
+  return (x > y) - (x < y);
 }
 
 static inline int
-TmHeap_distance_between(TmCell *a, TmCell *b)
+chunk_of(TmChunkRange *ranges, int count, TmCell *cell)
+{
+  int low = 0, high = count - 1;
+  while(low < high) {
+    int middle = (low + high + 1) / 2;
+    if(ranges[middle].cells <= cell) low = middle;
+    else high = middle - 1;
+  }
+  return ranges[low].index;
+}
+#endif
+
+/*
+ * Gives chunks holding nothing but white cells back to the pool, along with
+ * the ones still waiting in the reserve, so other heaps can use them. The
+ * chunk holding FREE always stays. Returns the number of cells given back.
+ */
+int
+TmHeap_shrink(TmHeap *heap)
+{
+#ifdef TM_COMPACT_CELLS
+  // Compact cells are indices into the heap's own arena, which can't be
+  // handed to another heap.
+  return 0;
+#else
+  int count = Tm_DArray_count(heap->chunks);
+  if(count < 2) return 0;
+
+  TmChunkRange *ranges = calloc(count, sizeof(TmChunkRange));
+  int *white = calloc(count, sizeof(int));
+  Tm_DArray *kept = Tm_DArray_create(sizeof(TmChunk*), count);
+  check_mem(ranges && white && kept);
+
+  for(int i=0; i < count; i++) {
+    ranges[i].cells = ((TmChunk*)Tm_DArray_at(heap->chunks, i))->cells;
+    ranges[i].index = i;
+  }
+  qsort(ranges, count, sizeof(TmChunkRange), compare_ranges);
+
+  // -(bottom)- ECRU -(top)- GREY -(scan)- BLACK -(free)- WHITE ...
+  TmCell *ptr = FREE;
+  if(FREE == BOTTOM && FREE == TOP && FREE == SCAN) {
+    do {
+      white[chunk_of(ranges, count, ptr)]++;
+      ptr = NEXT(ptr);
+    } while(ptr != FREE);
+  } else {
+    while(ptr != BOTTOM) {
+      white[chunk_of(ranges, count, ptr)]++;
+      ptr = NEXT(ptr);
+    }
+  }
+
+  int keep = chunk_of(ranges, count, FREE);
+  int released = 0;
+
+  for(int i=0; i < count; i++) {
+    TmChunk *chunk = Tm_DArray_at(heap->chunks, i);
+
+    if(i == keep || white[i] != chunk->linked) {
+      Tm_DArray_push(kept, chunk);
+      continue;
+    }
+
+    for(int j=0; j < chunk->linked; j++) unsnap(heap, chunk->cells + j);
+
+    heap->reserve   -= chunk->size - chunk->linked;
+    heap->capacity  -= chunk->size;
+    released += chunk->size;
+    TmChunk_destroy(chunk);
+  }
+
+  Tm_DArray_destroy(heap->chunks);
+  heap->chunks = kept;
+
+  // Chunks are linked in order, so the reserve starts at the first one that
+  // isn't fully linked.
+  heap->pending = 0;
+  while(heap->pending < Tm_DArray_count(kept) &&
+      ((TmChunk*)Tm_DArray_at(kept, heap->pending))->linked ==
+      ((TmChunk*)Tm_DArray_at(kept, heap->pending))->size) {
+    heap->pending++;
+  }
+
+  free(ranges);
+  free(white);
+  return released;
+
+error:
+  if(ranges) free(ranges);
+  if(white) free(white);
+  if(kept) Tm_DArray_destroy(kept);
+  return 0;
+#endif
+}
+
+/*
+ * Makes a cell allocated outside of the treadmill, holding an object, part
+ * of the immortal segment.
+ */
+void
+TmHeap_adopt(TmHeap *heap, TmCell *cell)
+{
+  cell->flags |= TM_IMMORTAL;
+  link_immortal(heap, cell);
+}
+
+static inline int
+TmHeap_distance_between(TmHeap *heap, TmCell *a, TmCell *b)
 {
   int count = 1;
   TmCell *ptr = a;
-  while((ptr = ptr->next) && ptr != b) count++;
+  while((ptr = NEXT(ptr)) != b) count++;
 
   return count;
 }
@@ -195,7 +586,7 @@ TmHeap_distance_between(TmCell *a, TmCell *b)
 double
 TmHeap_size(TmHeap *heap)
 {
-  return TmHeap_distance_between(TOP, TOP);
+  return TmHeap_distance_between(heap, TOP, TOP) + heap->reserve;
 }
 
 double
@@ -207,88 +598,205 @@ TmHeap_white_size(TmHeap *heap)
     return TmHeap_size(heap);
   }
 
-  return TmHeap_distance_between(FREE, BOTTOM);
+  return TmHeap_distance_between(heap, FREE, BOTTOM) + heap->reserve;
 }
 
 double
 TmHeap_ecru_size(TmHeap *heap)
 {
   if(BOTTOM == TOP) return 0;
-  return TmHeap_distance_between(BOTTOM, TOP);
+  return TmHeap_distance_between(heap, BOTTOM, TOP);
 }
 
 double
 TmHeap_grey_size(TmHeap *heap)
 {
   if(TOP == SCAN) return 0;
-  return TmHeap_distance_between(TOP, SCAN);
+  return TmHeap_distance_between(heap, TOP, SCAN);
 }
 
 double
 TmHeap_black_size(TmHeap *heap)
 {
   if(SCAN == FREE) return 0;
-  return TmHeap_distance_between(SCAN, FREE);
+  return TmHeap_distance_between(heap, SCAN, FREE);
 }
 
-static inline Tm_DArray*
-null_rootset(TmStateHeader *state)
+double
+TmHeap_immortal_size(TmHeap *heap)
 {
-  return Tm_DArray_create(sizeof(TmObjectHeader*), 1);
+  return heap->immortals;
 }
 
-void
-TmHeap_destroy(TmHeap* heap)
+double
+TmHeap_pinned_size(TmHeap *heap)
 {
-  debug("[GC] Destroying the heap");
-
-  // Ignore the rootset and flip twice to clean up
-  heap->state->rootset = null_rootset;
-  Tm_flip(heap);
-  Tm_flip(heap);
+  return heap->pins ? heap->pins->count : 0;
+}
 
-  TmCell *ptr = NULL;
+/*
+ * Every chunk cell that isn't white holds its object, white ones hold NULL,
+ * so releasing whatever is left only takes a sequential pass over each chunk.
+ * Image objects live in chunks of their own.
+ */
+static inline void
+release_all(TmHeap *heap)
+{
+  for(int i=0; i < Tm_DArray_count(heap->chunks); i++) {
+    TmChunk *chunk = Tm_DArray_at(heap->chunks, i);
 
-  ITERATE(BOTTOM, FREE, ptr) {
-    RELEASE(ptr->value);
-    ptr = ptr->next;
+    for(int j=0; j < chunk->linked; j++) {
+      TmCell *cell = chunk->cells + j;
+      if(cell->value) release_body(heap, cell->value);
+    }
   }
+}
+
+static void
+destroy(TmHeap *heap, int release)
+{
+  TmFork_destroy(heap);
+  if(heap->trace) TmTrace_stop(heap);
+  if(heap->region) TmRegion_destroy(heap);
+
+  TmHeap_destroy_weak(heap);
+  TmHeap_destroy_cards(heap);
+  TmHeap_destroy_pins(heap);
+  TmHeap_destroy_sites(heap);
+  Tm_Vec_free(&heap->remembered);
+
+  // Slab bodies go away with their slabs, only finalizers need a pass.
+  if(release && (RELEASE || !heap->slab_bodies)) release_all(heap);
+
+  TmHeap_destroy_images(heap);
 
   for(int i=0; i < Tm_DArray_count(heap->chunks); i++) {
-    TmCell *chunk = (TmCell*)Tm_DArray_at(heap->chunks, i);
-    free(chunk);
+    TmChunk_destroy((TmChunk*)Tm_DArray_at(heap->chunks, i));
   }
 
   Tm_DArray_destroy(heap->chunks);
 
+  while(heap->slabs) {
+    TmSlab *slab = heap->slabs;
+    heap->slabs = slab->next;
+    free(slab);
+  }
+
+#ifdef TM_COMPACT_CELLS
+  if(heap->cells) munmap(heap->cells, TM_ARENA_BYTES);
+#endif
+
   free(heap);
 }
 
-TmChunk
-TmChunk_new(int size)
+void
+TmHeap_destroy(TmHeap* heap)
 {
-  TmCell *memory = calloc(size, sizeof(TmCell));
-  TmCell *ptr    = memory;
+  debug("[GC] Destroying the heap");
+  destroy(heap, 1);
+}
 
-  for(int i=0; i < size; i++) {
-    if(i>0) {
-      TmCell *prev = ptr; prev--;
-      ptr->prev = prev;
-    }
-    if(i<size) {
-      TmCell *next = ptr; next++;
-      ptr->next = next;
-    }
-    ptr++;
+void
+TmHeap_discard(TmHeap* heap)
+{
+  debug("[GC] Discarding the heap");
+  check(heap->slab_bodies, "Only heaps with slab bodies can be discarded.");
+  destroy(heap, 0);
+  return;
+
+error:
+  destroy(heap, 1);
+}
+
+TmChunk*
+TmChunk_new(TmHeap *heap, int size)
+{
+  TmChunk *chunk = calloc(1, sizeof(TmChunk));
+  check_mem(chunk);
+
+#ifdef TM_COMPACT_CELLS
+  if(heap->cells == NULL) {
+    // Reserve address space for every cell the heap could ever index.
+    // Nothing is committed until cells are linked into the ring.
+    TmCell *arena = mmap(NULL, TM_ARENA_BYTES, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    check(arena != MAP_FAILED, "Out of memory.");
+    heap->cells = arena;
   }
 
-  TmCell *tail = --ptr;
+  check(heap->used + size <= TM_MAX_CELLS, "Out of cell indices.");
 
-  memory->prev = NULL;
-  tail->next   = NULL;
+  chunk->cells  = heap->cells + heap->used;
+  chunk->mapped = 0;
+  heap->used   += size;
+
+#ifdef MADV_HUGEPAGE
+  if(heap->huge_pages) {
+    uintptr_t start = (uintptr_t)chunk->cells & ~((uintptr_t)TM_PAGE_SIZE - 1);
+    uintptr_t end   = (uintptr_t)(chunk->cells + size);
+    madvise((void*)start, end - start, MADV_HUGEPAGE);
+  }
+#endif
+#else
+  // Round up to whole pages, so the pool can hand the mapping to any heap
+  // growing by about as much.
+  size_t page  = heap->huge_pages ? TM_HUGE_PAGE_SIZE : TM_PAGE_SIZE;
+  size_t bytes = (size * sizeof(TmCell) + page - 1) & ~(page - 1);
+
+  void *memory = TmPool_take(&bytes, heap->huge_pages);
+  check(memory, "Out of memory.");
+
+  chunk->cells  = (TmCell*)memory;
+  chunk->mapped = bytes;
+  chunk->huge   = heap->huge_pages;
+#endif
+
+  // Cells are not touched until they are linked into the ring, which is
+  // when they are cleared.
+  chunk->size   = size;
+  chunk->linked = 0;
 
-  TmChunk chunk = { .head = memory, .tail = tail };
   return chunk;
+
+error:
+  if(chunk) free(chunk);
+  return NULL;
+}
+
+void
+TmChunk_destroy(TmChunk *chunk)
+{
+  if(chunk->mapped) TmPool_give(chunk->cells, chunk->mapped, chunk->huge);
+  free(chunk);
+}
+
+static inline TmCell*
+lookahead_next(TmHeap *heap, TmCell *ahead, TmCell *end, int objects)
+{
+  if(ahead == end) return ahead;
+  ahead = NEXT(ahead);
+  TM_PREFETCH(NEXT(ahead));
+  if(objects) TM_PREFETCH(ahead->value);
+  return ahead;
+}
+
+static inline TmCell*
+lookahead_prev(TmHeap *heap, TmCell *ahead, TmCell *end)
+{
+  if(ahead == end) return ahead;
+  ahead = PREV(ahead);
+  TM_PREFETCH(PREV(ahead));
+  TM_PREFETCH(ahead->value);
+  return ahead;
+}
+
+static inline TmCell*
+lookahead_start(TmHeap *heap, TmCell *from, TmCell *end, int objects)
+{
+  for(int i=0; i < TM_PREFETCH_DISTANCE; i++) {
+    from = lookahead_next(heap, from, end, objects);
+  }
+  return from;
 }
 
 static inline void
@@ -296,12 +804,74 @@ make_grey_if_ecru(TmHeap *heap, TmObjectHeader *o)
 {
   TmCell *cell = o->cell;
   if(cell->ecru) {
-    // Unsnap the cell from the ecru area,
-    // and put it in the gray area.
+    // Unsnap the cell from the ecru area, and put it in the gray area (or
+    // straight into the black one if it has nothing to scan).
+    make_reachable(heap, cell);
+  }
+}
+
+/*
+ * Makes an object the collector might consider garbage reachable again.
+ */
+void
+Tm_shade(TmHeap *heap, TmObjectHeader *object)
+{
+  make_grey_if_ecru(heap, object);
+}
+
+/*
+ * Puts an object that may have been scanned already back in the grey area,
+ * so it's scanned again before the next flip.
+ */
+void
+Tm_rescan(TmHeap *heap, TmObjectHeader *object)
+{
+  TmCell *cell = object->cell;
+  if(cell->flags & (TM_IMMORTAL | TM_REGION)) return;
+
+  if(cell->ecru || (cell->flags & TM_LEAF)) {
+    make_grey_if_ecru(heap, object);
+  } else {
     make_grey(heap, cell);
   }
 }
 
+/*
+ * Full scans shade children through a small FIFO instead of straight away:
+ * a child's object is prefetched when it enters the buffer, its cell when it
+ * is halfway through, and by the time it leaves both are likely in cache.
+ */
+static inline void
+mark_drain(TmHeap *heap)
+{
+  while(heap->mark_count) {
+    TmObjectHeader *o = heap->marks[heap->mark_head];
+    heap->mark_head = (heap->mark_head + 1) & (TM_MARK_BUFFER - 1);
+    heap->mark_count--;
+    make_grey_if_ecru(heap, o);
+  }
+}
+
+static void
+mark_buffered(TmHeap *heap, TmObjectHeader *o)
+{
+  TM_PREFETCH(o);
+
+  if(heap->mark_count < TM_MARK_BUFFER) {
+    heap->marks[(heap->mark_head + heap->mark_count) & (TM_MARK_BUFFER - 1)] = o;
+    heap->mark_count++;
+    return;
+  }
+
+  TmObjectHeader *oldest = heap->marks[heap->mark_head];
+  heap->marks[heap->mark_head] = o;
+  heap->mark_head = (heap->mark_head + 1) & (TM_MARK_BUFFER - 1);
+
+  TM_PREFETCH(heap->marks[(heap->mark_head + TM_MARK_BUFFER / 2) & (TM_MARK_BUFFER - 1)]->cell);
+
+  make_grey_if_ecru(heap, oldest);
+}
+
 void
 Tm_scan(TmHeap *heap)
 {
@@ -311,81 +881,381 @@ Tm_scan(TmHeap *heap)
 
   // Move the scan pointer backwards, converting the scanned grey cell into a
   // black cell.
-  SCAN = SCAN->prev;
-  heap->scan_pointers(heap, SCAN->value, make_grey_if_ecru);
+  SCAN = PREV(SCAN);
+  scan_cell(heap, SCAN, make_grey_if_ecru);
 }
 
+/*
+ * Scans grey cells until there are none left. Cells only ever join the grey
+ * area at TOP, at the far end from SCAN, so a cursor walking ahead of SCAN
+ * towards TOP stays inside the grey area.
+ */
 void
-Tm_flip(TmHeap *heap)
+Tm_scan_all(TmHeap *heap)
 {
-  debug("[GC] Flip");
-  // Scan all the grey cells before flipping.
-  while(SCAN != TOP) Tm_scan(heap);
+  TmCell *ahead = SCAN;
+  int lead = 0;
+
+  do {
+    while(SCAN != TOP) {
+      while(lead < TM_PREFETCH_DISTANCE && ahead != TOP) {
+        ahead = lookahead_prev(heap, ahead, TOP);
+        lead++;
+      }
+
+      SCAN = PREV(SCAN);
+      scan_cell(heap, SCAN, mark_buffered);
+
+      if(lead > 0) lead--;
+      else ahead = SCAN;
+    }
+
+    mark_drain(heap);
+  } while(SCAN != TOP);
+}
+
+// Dead old objects may have been remembered.
+static inline void
+forget_remembered(TmHeap *heap, TmObjectHeader *object)
+{
+  for(int i=0; i < Tm_Vec_count(&heap->remembered); i++) {
+    if(Tm_Vec_at(&heap->remembered, i) == object) {
+      Tm_Vec_at(&heap->remembered, i) = Tm_Vec_pop(&heap->remembered);
+      return;
+    }
+  }
+}
+
+/*
+ * Whatever is still ecru once tracing is done is garbage: forget weak
+ * references to it, then make it white and release it.
+ */
+static void
+release_ecru(TmHeap *heap)
+{
+  TmHeap_clear_weak(heap);
+  TmHeap_age_sites(heap);
+  if(heap->region) TmRegion_forget_dead(heap);
 
   TmCell *ptr = NULL;
+  TmCell *ahead = lookahead_start(heap, BOTTOM, TOP, 1);
 
-  // Make all the ecru into white and release them
   ITERATE(BOTTOM, TOP, ptr) {
+    ahead = lookahead_next(heap, ahead, TOP, 1);
     ptr->ecru = 0;
-    RELEASE(ptr->value);
-    ptr = ptr->next;
+    if(heap->trace) TmTrace_release(heap, ptr->value);
+    if(ptr->flags & TM_CARDS) TmHeap_forget_cards(heap, ptr->value);
+    if(ptr->flags & TM_REMEMBERED) forget_remembered(heap, ptr->value);
+    release_body(heap, ptr->value);
+    ptr->value = NULL;
+    ptr = NEXT(ptr);
   }
   BOTTOM = TOP;
+}
 
-  TmHeap_grow(heap, heap->growth_rate);
+/*
+ * Every TM_OLD_EVERY flips, old objects are collected along with the others:
+ * they're black when this flip turns them ecru, and the next flip puts the
+ * ones left black back among the immortals.
+ */
+static void
+collect_old(TmHeap *heap)
+{
+  debug("[GC] Collecting old objects");
+  TmCell *ptr = heap->immortal;
+  int count = heap->immortals;
+
+  for(int i=0; i < count; i++) {
+    TmCell *next = NEXT(ptr);
+    if(ptr->flags & TM_OLD) make_mortal(heap, ptr);
+    ptr = next;
+  }
+  heap->collecting_old = 1;
+}
+
+static void
+settle_old(TmHeap *heap)
+{
+  TmCell *ptr = NULL;
 
-  // Make all black into ecru.
   ITERATE(SCAN, FREE, ptr) {
-    TmCell *next = ptr->next;
-    make_ecru(heap, ptr);
+    TmCell *next = NEXT(ptr);
+    if(ptr->flags & TM_OLD) {
+      ptr->flags |= TM_IMMORTAL;
+      make_immortal(heap, ptr);
+    }
     ptr = next;
   }
+  heap->collecting_old = 0;
+}
 
-  // Add all the rootset into the grey set.
-  Tm_DArray *rootset = heap->state->rootset(heap->state);
+// Make all black into ecru.
+static void
+black_to_ecru(TmHeap *heap)
+{
+  TmCell *ptr = NULL;
+  TmCell *ahead = lookahead_start(heap, SCAN, FREE, 0);
 
+  ITERATE(SCAN, FREE, ptr) {
+    TmCell *next = NEXT(ptr);
+    ahead = lookahead_next(heap, ahead, FREE, 0);
+    make_ecru(heap, ptr);
+    ptr = next;
+  }
+  TmHeap_reset_cards(heap);
+}
+
+// Add the rootset, and everything else that keeps objects alive, into the
+// grey set.
+static void
+shade_roots(TmHeap *heap, Tm_DArray *rootset)
+{
   int count = Tm_DArray_count(rootset);
   debug("[GC] Adding rootset (%i)", count);
   for(int i=0; i < count; i++) {
     TmObjectHeader *o = (TmObjectHeader*)(Tm_DArray_at(rootset, i));
     TmCell *cell = o->cell;
-    make_grey(heap, cell);
+    if(cell->flags & (TM_IMMORTAL | TM_REGION)) continue;
+    make_reachable(heap, cell);
+  }
+
+  // Pinned objects are roots too, whether the program can reach them or not.
+  TmHeap_scan_pins(heap, make_grey_if_ecru);
+
+  // Immortal objects keep whatever they point to alive.
+  debug("[GC] Scanning immortals (%i)", heap->immortals);
+  TmCell *ptr = heap->immortal;
+  for(int i=0; i < heap->immortals; i++) {
+    if(!(ptr->flags & TM_OLD)) scan_cell(heap, ptr, make_grey_if_ecru);
+    ptr = NEXT(ptr);
+  }
+
+  // Pretenured ones only if they were given collected objects.
+  for(int i=0; i < Tm_Vec_count(&heap->remembered); i++) {
+    scan_cell(heap, Tm_Vec_at(&heap->remembered, i)->cell, make_grey_if_ecru);
+  }
+
+  // So do the objects of the current region.
+  if(heap->region) TmRegion_scan(heap, make_grey_if_ecru);
+}
+
+// What a forked child runs on its copy of the heap.
+static void
+trace_forked(TmHeap *heap, Tm_DArray *rootset)
+{
+  black_to_ecru(heap);
+  shade_roots(heap, rootset);
+  Tm_scan_all(heap);
+}
+
+/*
+ * Called with the objects a forked child found unreachable. Their cells are
+ * black, and go to the end of the ecru area, which may be empty, unlike
+ * make_ecru that grows it from BOTTOM while the flip works through the black
+ * cells in order.
+ */
+static void
+condemn(TmHeap *heap, TmObjectHeader *object)
+{
+  TmCell *self = object->cell;
+  unsnap(heap, self);
+
+  TmCell *his_prev = PREV(TOP);
+  SET_NEXT(his_prev, self);
+  SET_PREV(self, his_prev);
+  SET_NEXT(self, TOP);
+  SET_PREV(TOP, self);
+
+  if(BOTTOM == TOP) BOTTOM = self;
+  self->ecru = 1;
+}
+
+void
+Tm_flip(TmHeap *heap)
+{
+  debug("[GC] Flip");
+  // Whatever the last child found dead gets released by this flip.
+  TmFork_finish(heap, condemn);
+  if(heap->trace) TmTrace_flip(heap);
+
+  // Scan all the grey cells before flipping.
+  Tm_scan_all(heap);
+  release_ecru(heap);
+  if(heap->collecting_old) settle_old(heap);
+
+  TmHeap_grow(heap, heap->growth_rate);
+  if(++heap->flips % TM_OLD_EVERY == 0) collect_old(heap);
+
+  Tm_DArray *rootset = heap->state->rootset(heap->state);
+  if(heap->trace) TmTrace_roots(heap, rootset);
+
+  // A child traces from here, and the parent keeps everything black until it
+  // hears back.
+  int forked = heap->fork_collect && !heap->weak_refs && !heap->weak_tables &&
+    TmFork_start(heap, rootset, trace_forked) == 0;
+
+  if(!forked) {
+    black_to_ecru(heap);
+    shade_roots(heap, rootset);
   }
 
   Tm_DArray_destroy(rootset);
 }
 
+/*
+ * FREE itself is always kept white, as the boundary between the black and
+ * the ecru areas, so there's room for an object if the cell after it is
+ * white too.
+ */
+static inline int
+has_white(TmHeap *heap)
+{
+  return NEXT(FREE) != BOTTOM;
+}
+
+/*
+ * Last resort when there's no white cell left after a flip, or no memory for
+ * an object: collect everything that is garbage right now, grow the heap as
+ * far as max_size allows, and if that's not enough, let the out_of_memory
+ * callback shed some load and try once more.
+ */
+static TmObjectHeader*
+allocate_hard(TmHeap *heap)
+{
+  for(int attempt = 0; attempt < 2; attempt++) {
+    if(attempt > 0 && !(heap->out_of_memory && heap->out_of_memory(heap))) break;
+
+    debug("[GC] Emergency collection");
+    // A flip releases what the previous one found unreachable, so two of
+    // them release everything that is unreachable now.
+    Tm_flip(heap);
+    Tm_flip(heap);
+
+    if(!has_white(heap)) {
+      TmHeap_grow(heap, heap->growth_rate > TM_LINK_BATCH ? heap->growth_rate : TM_LINK_BATCH);
+    }
+    if(!has_white(heap)) TmHeap_link(heap, TM_LINK_BATCH);
+
+    if(has_white(heap)) {
+      TmObjectHeader *header = new_body(heap);
+      if(header) return header;
+    }
+  }
+
+  log_err("Heap full.");
+  return NULL;
+}
+
+/*
+ * Gives a copy of an object from outside the treadmill a black cell, without
+ * collecting, since the caller may be holding pointers the rootset doesn't
+ * know about.
+ */
+TmObjectHeader*
+TmHeap_promote(TmHeap *heap, TmObjectHeader *object, int flags)
+{
+  if(!has_white(heap)) TmHeap_link(heap, TM_LINK_BATCH);
+  if(!has_white(heap)) {
+    TmHeap_grow(heap, heap->growth_rate > TM_LINK_BATCH ? heap->growth_rate : TM_LINK_BATCH);
+    TmHeap_link(heap, TM_LINK_BATCH);
+  }
+  check(has_white(heap), "Heap full.");
+
+  TmObjectHeader *copy = new_body(heap);
+  check_mem(copy);
+  memcpy(copy, object, heap->object_size);
+
+  TmCell *cell = FREE;
+  copy->cell   = cell;
+  cell->value  = copy;
+  cell->flags  = flags;
+  FREE = NEXT(FREE);
+
+  if(heap->trace) TmTrace_promote(heap, object, copy, flags);
+
+  return copy;
+
+error:
+  return NULL;
+}
+
+// Out-of-line copies of the inline allocation path, for the exported symbols.
+extern inline TmObjectHeader* Tm_allocate_flags(TmHeap *heap, int flags);
+extern inline TmObjectHeader* Tm_allocate(TmHeap *heap);
+extern inline TmObjectHeader* Tm_allocate_hint(TmHeap *heap, int hint);
+
+// Everything the inline allocation path in gc.h doesn't handle.
 TmObjectHeader*
-Tm_allocate(TmHeap *heap)
+Tm_allocate_slow(TmHeap *heap, int flags)
 {
+  if(heap->region && !(flags & TM_IMMORTAL)) return TmRegion_allocate(heap, flags);
+
   if(heap->allocs >= heap->scan_every) {
     heap->allocs = 0;
+    TmFork_poll(heap);
     Tm_scan(heap);
   }
 
   /*
-   * If there are no slots in the white list,
-   * force a collection.
+   * If there are no slots in the white list, link more from the reserve,
+   * and if that's empty too, force a collection.
    */
-  if(FREE->next == BOTTOM) {
+  if(!has_white(heap)) TmHeap_link(heap, TM_LINK_BATCH);
+
+  if(!has_white(heap)) {
     Tm_flip(heap);
-    check(FREE != BOTTOM, "Heap full.");
+    if(!has_white(heap)) TmHeap_link(heap, TM_LINK_BATCH);
   }
 
-  TmObjectHeader *header = calloc(1, heap->object_size);
-  check(header, "Out of memory.");
+  TmObjectHeader *header = has_white(heap) ? new_body(heap) : NULL;
+  if(header == NULL) header = allocate_hard(heap);
+  if(header == NULL) return NULL;
 
-  TmCell *free = FREE;
-  header->cell = free;
-  header->cell->value = header;
+  TmCell *cell = FREE;
+  header->cell = cell;
+  cell->value  = header;
+  cell->flags  = flags;
 
-  FREE = FREE->next;
+  if(flags & TM_IMMORTAL) {
+    make_immortal(heap, cell);
+  } else {
+    FREE = NEXT(FREE);
+  }
 
   heap->allocs++;
   heap->warm = 1;
 
+  if(heap->trace) TmTrace_allocate(heap, header, flags);
+
   return header;
-error:
-  exit(EXIT_FAILURE);
-  return NULL;
+}
+
+void
+Tm_write_barrier(TmHeap *heap, TmObjectHeader *object, uintptr_t field, TmObjectHeader *value)
+{
+  if(heap->trace) TmTrace_write(heap, object, field, value);
+  if(heap->region) TmRegion_write(heap, object, value);
+
+  // Pretenured objects given a collected object start being scanned at each
+  // flip. The value may be ecru in the middle of a collection, so it's
+  // shaded until then.
+  TmCell *cell = object->cell;
+  if(value && (cell->flags & TM_OLD) && !(value->cell->flags & TM_IMMORTAL)) {
+    Tm_shade(heap, value);
+
+    if(!(cell->flags & TM_REMEMBERED)) {
+      // Without room to remember it, it's scanned like any other immortal.
+      if(Tm_Vec_push(&heap->remembered, object) == 0) {
+        cell->flags |= TM_REMEMBERED;
+      } else {
+        cell->flags &= ~TM_OLD;
+      }
+    }
+  }
+
+  // Tracked objects that were scanned already are scanned again, but only
+  // the cards written to.
+  if(value && (cell->flags & TM_CARDS)) {
+    if(TmCards_mark(TmHeap_cards(heap, object), field)) make_grey(heap, cell);
+  }
 }
@@ -0,0 +1,353 @@
+#define _DEFAULT_SOURCE
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <treadmill/image.h>
+
+#define TM_PAGE_SIZE 4096
+
+#define TM_IMAGE_HEADER (2 * sizeof(uint32_t) + 4 * sizeof(uint64_t))
+
+typedef struct tm_image_entry_s {
+  TmObjectHeader *object;
+  uint64_t offset;
+} TmImageEntry;
+
+static inline void
+TmImage_flush(TmImage *image)
+{
+  size_t done = 0;
+
+  while(!image->failed && done < image->used) {
+    ssize_t written = write(image->fd, image->buffer + done, image->used - done);
+    if(written < 0) {
+      log_err("Failed to write heap image.");
+      image->failed = 1;
+    } else {
+      done += written;
+    }
+  }
+
+  image->used = 0;
+}
+
+static inline void
+TmImage_write(TmImage *image, const void *data, size_t size)
+{
+  const unsigned char *bytes = data;
+
+  while(size > 0) {
+    if(image->used == TM_IMAGE_BUFFER) TmImage_flush(image);
+
+    size_t room = TM_IMAGE_BUFFER - image->used;
+    size_t chunk = size < room ? size : room;
+    memcpy(image->buffer + image->used, bytes, chunk);
+    image->used += chunk;
+    bytes += chunk;
+    size -= chunk;
+  }
+}
+
+static int
+compare_entries(const void *a, const void *b)
+{
+  uintptr_t x = (uintptr_t)((const TmImageEntry*)a)->object;
+  uintptr_t y = (uintptr_t)((const TmImageEntry*)b)->object;
+  return (x > y) - (x < y);
+}
+
+static inline uint64_t
+TmImage_offset_of(TmImage *image, TmObjectHeader *object)
+{
+  if(object == NULL) return 0;
+
+  TmImageEntry key = { .object = object };
+  TmImageEntry *found = bsearch(&key, image->entries, image->count,
+      sizeof(TmImageEntry), compare_entries);
+
+  if(found == NULL) {
+    log_err("Object %p is not part of the heap image.", object);
+    image->failed = 1;
+    return 0;
+  }
+
+  return found->offset;
+}
+
+// Rewrites a slot of the object being saved, in its copy, as an offset.
+static void
+TmImage_save_slot(TmHeap *heap, TmObjectHeader **slot)
+{
+  TmImage *image = heap->image;
+  size_t at = (char*)slot - (char*)image->object;
+  uintptr_t offset = (uintptr_t)TmImage_offset_of(image, *slot);
+  memcpy(image->copy + at, &offset, sizeof(offset));
+}
+
+// Offsets read from an image must be the start of one of its bodies.
+static inline int
+TmImage_valid_offset(TmImage *image, size_t size, uint64_t offset)
+{
+  return offset >= image->data &&
+    (offset - image->data) / size < image->count &&
+    (offset - image->data) % size == 0;
+}
+
+// Turns an offset back into a pointer into the mapped image.
+static void
+TmImage_load_slot(TmHeap *heap, TmObjectHeader **slot)
+{
+  TmImage *image = heap->image;
+  uintptr_t offset = (uintptr_t)*slot;
+  if(offset == 0) return;
+
+  if(!TmImage_valid_offset(image, heap->object_size, offset)) {
+    image->failed = 1;
+    *slot = NULL;
+    return;
+  }
+
+  *slot = (TmObjectHeader*)(image->memory + offset);
+}
+
+static inline void
+TmImage_add(TmImage *image, TmCell *cell)
+{
+  image->entries[image->count].object = cell->value;
+  image->count++;
+}
+
+/*
+ * Runs a full collection, so the image holds exactly the objects reachable
+ * from the rootset and the immortal ones, and writes them to fd.
+ */
+int
+TmHeap_save_image(TmHeap *heap, int fd)
+{
+  TmImage image = { .fd = fd };
+  unsigned char *flags = NULL;
+  TmObjectHeader **objects = NULL;
+  check(heap->scan_slots, "Saving a heap image needs a scan_slots function.");
+
+  // A forked flip leaves the garbage black until the child reports it.
+  int fork_collect = heap->fork_collect;
+  heap->fork_collect = 0;
+  Tm_flip(heap);
+  Tm_scan_all(heap);
+  heap->fork_collect = fork_collect;
+
+  size_t count = (size_t)(TmHeap_black_size(heap) + heap->immortals);
+  image.entries = calloc(count + 1, sizeof(TmImageEntry));
+  image.copy    = malloc(heap->object_size);
+  image.buffer  = malloc(TM_IMAGE_BUFFER);
+  check_mem(image.entries && image.copy && image.buffer);
+
+  for(TmCell *ptr = heap->scan; ptr != heap->free; ptr = TmCell_next(heap, ptr)) {
+    TmImage_add(&image, ptr);
+  }
+  TmCell *ptr = heap->immortal;
+  for(int i=0; i < heap->immortals; i++) {
+    TmImage_add(&image, ptr);
+    ptr = TmCell_next(heap, ptr);
+  }
+
+  // Flags go in ring order, so record them before sorting.
+  flags = malloc(count + 1);
+  check_mem(flags);
+  for(size_t i=0; i < count; i++) {
+    flags[i] = image.entries[i].object->cell->flags & TM_LEAF;
+  }
+
+  Tm_DArray *rootset = heap->state->rootset(heap->state);
+  uint64_t roots = Tm_DArray_count(rootset);
+
+  uint64_t data = TM_IMAGE_HEADER + roots * sizeof(uint64_t) + count;
+  data = (data + TM_PAGE_SIZE - 1) & ~((uint64_t)TM_PAGE_SIZE - 1);
+
+  for(size_t i=0; i < count; i++) {
+    image.entries[i].offset = data + i * heap->object_size;
+  }
+
+  // Bodies are written in ring order, which is the order of the offsets.
+  objects = malloc((count + 1) * sizeof(TmObjectHeader*));
+  check_mem(objects);
+  for(size_t i=0; i < count; i++) objects[i] = image.entries[i].object;
+
+  qsort(image.entries, count, sizeof(TmImageEntry), compare_entries);
+
+  uint32_t magic   = TM_IMAGE_MAGIC;
+  uint32_t version = TM_IMAGE_VERSION;
+  uint64_t size    = heap->object_size;
+  uint64_t total   = count;
+  TmImage_write(&image, &magic, sizeof(magic));
+  TmImage_write(&image, &version, sizeof(version));
+  TmImage_write(&image, &size, sizeof(size));
+  TmImage_write(&image, &total, sizeof(total));
+  TmImage_write(&image, &roots, sizeof(roots));
+  TmImage_write(&image, &data, sizeof(data));
+
+  for(size_t i=0; i < roots; i++) {
+    uint64_t offset = TmImage_offset_of(&image, Tm_DArray_at(rootset, i));
+    TmImage_write(&image, &offset, sizeof(offset));
+  }
+  Tm_DArray_destroy(rootset);
+
+  TmImage_write(&image, flags, count);
+
+  uint64_t written = TM_IMAGE_HEADER + roots * sizeof(uint64_t) + count;
+  unsigned char zero = 0;
+  for(; written < data; written++) TmImage_write(&image, &zero, sizeof(zero));
+
+  heap->image = &image;
+  for(size_t i=0; i < count; i++) {
+    TmObjectHeader *object = objects[i];
+
+    memcpy(image.copy, object, heap->object_size);
+    ((TmObjectHeader*)image.copy)->cell = NULL;
+
+    if(!(object->cell->flags & TM_LEAF)) {
+      image.object = object;
+      heap->scan_slots(heap, object, TmImage_save_slot);
+    }
+
+    TmImage_write(&image, image.copy, heap->object_size);
+  }
+  heap->image = NULL;
+
+  TmImage_flush(&image);
+
+  free(objects);
+  free(flags);
+  free(image.entries);
+  free(image.copy);
+  free(image.buffer);
+
+  return image.failed ? -1 : 0;
+
+error:
+  free(objects);
+  free(flags);
+  free(image.entries);
+  free(image.copy);
+  free(image.buffer);
+  return -1;
+}
+
+/*
+ * Maps an image copy-on-write and makes its objects immortal: bodies stay in
+ * the mapping, though every one of them is written to, to point it at its
+ * cell. Returns the rootset the image was saved with.
+ */
+Tm_DArray*
+TmHeap_load_image(TmHeap *heap, int fd)
+{
+  TmImage *image = NULL;
+  char *memory = MAP_FAILED;
+  size_t length = 0;
+  struct stat info;
+
+  check(heap->scan_slots, "Loading a heap image needs a scan_slots function.");
+  check(fstat(fd, &info) == 0, "Can't stat heap image.");
+  check((size_t)info.st_size >= TM_IMAGE_HEADER, "Truncated heap image.");
+
+  length = info.st_size;
+  memory = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  check(memory != MAP_FAILED, "Can't map heap image.");
+
+  uint32_t magic, version;
+  uint64_t size, count, roots, data;
+  char *header = memory;
+  memcpy(&magic, header, sizeof(magic));     header += sizeof(magic);
+  memcpy(&version, header, sizeof(version)); header += sizeof(version);
+  memcpy(&size, header, sizeof(size));       header += sizeof(size);
+  memcpy(&count, header, sizeof(count));     header += sizeof(count);
+  memcpy(&roots, header, sizeof(roots));     header += sizeof(roots);
+  memcpy(&data, header, sizeof(data));       header += sizeof(data);
+
+  check(magic == TM_IMAGE_MAGIC, "Not a heap image.");
+  check(version == TM_IMAGE_VERSION, "Unsupported heap image version.");
+  check(size == heap->object_size, "Heap image holds objects of a different size.");
+
+  // Each part fits in the file before they're added up, so nothing wraps.
+  check(roots <= length / sizeof(uint64_t) && count <= length, "Truncated heap image.");
+  check(data >= TM_IMAGE_HEADER + roots * sizeof(uint64_t) + count &&
+      data <= length && count <= (length - data) / size, "Truncated heap image.");
+  check(count <= INT_MAX, "Heap image holds too many objects.");
+
+  image = calloc(1, sizeof(TmImage));
+  check_mem(image);
+  image->memory = memory;
+  image->length = length;
+  image->data   = data;
+  image->count  = count;
+
+  for(size_t i=0; i < roots; i++) {
+    uint64_t offset;
+    memcpy(&offset, header + i * sizeof(uint64_t), sizeof(offset));
+    check(offset == 0 || TmImage_valid_offset(image, size, offset),
+        "Heap image holds roots out of bounds.");
+  }
+
+  unsigned char *flags = (unsigned char*)header + roots * sizeof(uint64_t);
+
+  // Every pointer is checked before any object joins the heap, so a bad
+  // image leaves nothing behind.
+  heap->image = image;
+  for(size_t i=0; i < count; i++) {
+    TmObjectHeader *object = (TmObjectHeader*)(memory + data + i * size);
+    if(!(flags[i] & TM_LEAF)) heap->scan_slots(heap, object, TmImage_load_slot);
+  }
+  heap->image = NULL;
+  check(!image->failed, "Heap image holds pointers out of bounds.");
+
+  if(count > 0) {
+    image->chunk = TmChunk_new(heap, count);
+    check(image->chunk, "Failed to allocate cells for the heap image.");
+  }
+
+  for(size_t i=0; i < count; i++) {
+    TmObjectHeader *object = (TmObjectHeader*)(memory + data + i * size);
+    TmCell *cell = image->chunk->cells + i;
+
+    object->cell = cell;
+    cell->value  = object;
+    cell->flags  = (flags[i] & TM_LEAF) | TM_IMMORTAL | TM_IMAGE;
+
+    TmHeap_adopt(heap, cell);
+  }
+
+  // The objects are part of the heap now, so is the mapping.
+  if(heap->images == NULL) heap->images = Tm_DArray_create(sizeof(TmImage*), 4);
+  Tm_DArray_push(heap->images, image);
+
+  Tm_DArray *rootset = Tm_DArray_create(sizeof(TmObjectHeader*), roots + 1);
+  for(size_t i=0; i < roots; i++) {
+    uint64_t offset;
+    memcpy(&offset, header + i * sizeof(uint64_t), sizeof(offset));
+    Tm_DArray_push(rootset, offset ? memory + offset : NULL);
+  }
+
+  return rootset;
+
+error:
+  if(image) free(image);
+  if(memory != MAP_FAILED) munmap(memory, length);
+  return NULL;
+}
+
+void
+TmHeap_destroy_images(TmHeap *heap)
+{
+  if(heap->images == NULL) return;
+
+  for(int i=0; i < Tm_DArray_count(heap->images); i++) {
+    TmImage *image = Tm_DArray_at(heap->images, i);
+    if(image->chunk) TmChunk_destroy(image->chunk);
+    munmap(image->memory, image->length);
+    free(image);
+  }
+
+  Tm_DArray_destroy(heap->images);
+  heap->images = NULL;
+}
@@ -0,0 +1,87 @@
+#include <stdint.h>
+#include <treadmill/pin.h>
+#include <treadmill/fork.h>
+
+// Pin counts are kept in the table's values.
+#define COUNT(V) ((int)(intptr_t)(V))
+#define VALUE(C) ((void*)(intptr_t)(C))
+
+int
+Tm_pin(TmHeap *heap, TmObjectHeader *object)
+{
+  check(!(object->cell->flags & TM_REGION), "Region objects can't be pinned.");
+
+  if(heap->pins == NULL) {
+    heap->pins = calloc(1, sizeof(TmTable));
+    check_mem(heap->pins);
+  }
+
+  TmTable *table = heap->pins;
+  int i = TmTable_find(table, object);
+
+  if(i < 0) {
+    i = TmTable_insert(table, object);
+    check(i >= 0, "Failed to grow the pin table.");
+
+    // The object may be ecru in the middle of a collection, or known dead
+    // to a forked one.
+    Tm_shade(heap, object);
+    if(heap->fork) heap->fork->stale = 1;
+  }
+
+  table->values[i] = VALUE(COUNT(table->values[i]) + 1);
+  return 0;
+
+error:
+  return -1;
+}
+
+int
+Tm_unpin(TmHeap *heap, TmObjectHeader *object)
+{
+  TmTable *table = heap->pins;
+  int i = table ? TmTable_find(table, object) : -1;
+  check(i >= 0, "Unpinning an object that isn't pinned.");
+
+  int count = COUNT(table->values[i]) - 1;
+  if(count == 0) {
+    TmTable_remove_at(table, i);
+  } else {
+    table->values[i] = VALUE(count);
+  }
+
+  return count;
+
+error:
+  return -1;
+}
+
+int
+Tm_pins(TmHeap *heap, TmObjectHeader *object)
+{
+  return heap->pins ? COUNT(TmTable_get(heap->pins, object)) : 0;
+}
+
+void
+TmHeap_scan_pins(TmHeap *heap, TmCallbackFn callback)
+{
+  TmTable *table = heap->pins;
+  if(table == NULL) return;
+
+  for(int i=0; i < table->capacity; i++) {
+    if(TmTable_live(table, i)) callback(heap, (TmObjectHeader*)table->keys[i]);
+  }
+}
+
+void
+TmHeap_destroy_pins(TmHeap *heap)
+{
+  TmTable *table = heap->pins;
+  if(table == NULL) return;
+
+  if(table->count > 0) log_warn("Destroying a heap with %i pinned objects.", table->count);
+
+  TmTable_free(table);
+  free(table);
+  heap->pins = NULL;
+}
@@ -0,0 +1,221 @@
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <treadmill/pool.h>
+#include <treadmill/_dbg.h>
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+#define TM_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+typedef struct tm_mapping_s {
+  void *memory;
+  size_t bytes;
+  int huge;
+  struct tm_mapping_s *next;
+} TmMapping;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static TmMapping *idle_list = NULL;
+static size_t idle       = 0;
+static size_t idle_limit = TM_POOL_IDLE_LIMIT;
+static size_t mapped     = 0;
+static size_t budget     = 0;
+
+static void*
+map(size_t bytes, int huge)
+{
+  size_t extra = huge ? TM_HUGE_PAGE_SIZE : 0;
+
+  char *memory = mmap(NULL, bytes + extra, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(memory == MAP_FAILED) return NULL;
+
+  if(extra) {
+    // Map a little more than we need so the memory can start on a huge page
+    // boundary, then give back what's left over on both sides.
+    char *aligned = (char*)(((uintptr_t)memory + extra - 1) & ~((uintptr_t)extra - 1));
+    if(aligned > memory) munmap(memory, aligned - memory);
+    if(memory + extra > aligned) munmap(aligned + bytes, memory + extra - aligned);
+    memory = aligned;
+#ifdef MADV_HUGEPAGE
+    madvise(memory, bytes, MADV_HUGEPAGE);
+#endif
+  }
+
+  return memory;
+}
+
+// Unmaps idle mappings until at least `needed` bytes are freed. Expects the
+// lock to be held, returns the list of mappings to unmap.
+static TmMapping*
+evict(size_t needed)
+{
+  TmMapping *evicted = NULL;
+  size_t freed = 0;
+
+  while(idle_list && freed < needed) {
+    TmMapping *mapping = idle_list;
+    idle_list = mapping->next;
+
+    idle   -= mapping->bytes;
+    mapped -= mapping->bytes;
+    freed  += mapping->bytes;
+
+    mapping->next = evicted;
+    evicted = mapping;
+  }
+
+  return evicted;
+}
+
+static void
+unmap_all(TmMapping *list)
+{
+  while(list) {
+    TmMapping *next = list->next;
+    munmap(list->memory, list->bytes);
+    free(list);
+    list = next;
+  }
+}
+
+/*
+ * Returns at least `*bytes` of memory, and sets `*bytes` to the size to give
+ * back. The smallest idle mapping that fits is reused, as long as it isn't
+ * more than twice as large, so heaps growing by different amounts still
+ * share warm chunks. Reused mappings are handed out as they were given back,
+ * without touching their pages.
+ */
+void*
+TmPool_take(size_t *bytes, int huge)
+{
+  size_t wanted = *bytes;
+  TmMapping **best = NULL;
+  TmMapping *found = NULL;
+  TmMapping *evicted = NULL;
+
+  pthread_mutex_lock(&lock);
+
+  for(TmMapping **ptr = &idle_list; *ptr; ptr = &(*ptr)->next) {
+    size_t size = (*ptr)->bytes;
+    if((*ptr)->huge != huge || size < wanted || size / 2 > wanted) continue;
+    if(best == NULL || size < (*best)->bytes) best = ptr;
+    if(size == wanted) break;
+  }
+
+  if(best) {
+    found = *best;
+    *best = found->next;
+    idle -= found->bytes;
+  } else {
+    if(budget && mapped + wanted > budget) {
+      evicted = evict(mapped + wanted - budget);
+    }
+    if(budget && mapped + wanted > budget) {
+      pthread_mutex_unlock(&lock);
+      unmap_all(evicted);
+      log_err("Chunk pool budget exceeded.");
+      return NULL;
+    }
+    // Count the mapping before making it, so racing heaps stay in budget.
+    mapped += wanted;
+  }
+
+  pthread_mutex_unlock(&lock);
+  unmap_all(evicted);
+
+  if(found) {
+    void *memory = found->memory;
+    *bytes = found->bytes;
+    free(found);
+    return memory;
+  }
+
+  void *memory = map(wanted, huge);
+  if(memory == NULL) {
+    pthread_mutex_lock(&lock);
+    mapped -= wanted;
+    pthread_mutex_unlock(&lock);
+  }
+
+  return memory;
+}
+
+void
+TmPool_give(void *memory, size_t bytes, int huge)
+{
+  TmMapping *mapping = malloc(sizeof(TmMapping));
+
+  pthread_mutex_lock(&lock);
+  if(mapping && idle + bytes <= idle_limit) {
+    mapping->memory = memory;
+    mapping->bytes  = bytes;
+    mapping->huge   = huge;
+    mapping->next   = idle_list;
+    idle_list = mapping;
+    idle += bytes;
+    memory = NULL;
+  } else {
+    mapped -= bytes;
+  }
+  pthread_mutex_unlock(&lock);
+
+  if(memory) {
+    free(mapping);
+    munmap(memory, bytes);
+  }
+}
+
+void
+TmPool_set_budget(size_t bytes)
+{
+  pthread_mutex_lock(&lock);
+  budget = bytes;
+  pthread_mutex_unlock(&lock);
+}
+
+void
+TmPool_set_idle_limit(size_t bytes)
+{
+  pthread_mutex_lock(&lock);
+  idle_limit = bytes;
+  TmMapping *evicted = idle > idle_limit ? evict(idle - idle_limit) : NULL;
+  pthread_mutex_unlock(&lock);
+
+  unmap_all(evicted);
+}
+
+size_t
+TmPool_mapped(void)
+{
+  pthread_mutex_lock(&lock);
+  size_t bytes = mapped;
+  pthread_mutex_unlock(&lock);
+  return bytes;
+}
+
+size_t
+TmPool_idle(void)
+{
+  pthread_mutex_lock(&lock);
+  size_t bytes = idle;
+  pthread_mutex_unlock(&lock);
+  return bytes;
+}
+
+void
+TmPool_trim(void)
+{
+  pthread_mutex_lock(&lock);
+  TmMapping *evicted = evict(idle);
+  pthread_mutex_unlock(&lock);
+
+  unmap_all(evicted);
+}
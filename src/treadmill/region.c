@@ -0,0 +1,224 @@
+#include <treadmill/region.h>
+#include <treadmill/trace.h>
+
+// Each object is preceded by room for the address of its copy, keeping
+// bodies aligned like malloc's.
+#define TM_REGION_PREFIX 16
+#define TM_REGION_HEADER ((sizeof(TmRegionBlock) + 15) & ~(size_t)15)
+
+#define FORWARD(O) (*(TmObjectHeader**)((char*)(O) - TM_REGION_PREFIX))
+
+static inline int
+in_region(TmRegion *region, TmObjectHeader *object)
+{
+  return object->cell >= region->cells && object->cell < region->cells + 3;
+}
+
+int
+Tm_region_begin(TmHeap *heap)
+{
+  check(heap->region == NULL, "Regions don't nest.");
+  check(heap->scan_slots != NULL, "Regions need scan_slots to promote survivors.");
+
+  TmRegion *region = calloc(1, sizeof(TmRegion));
+  check_mem(region);
+
+  region->cells[TM_REGION_OBJECT].flags    = TM_REGION;
+  region->cells[TM_REGION_LEAF].flags      = TM_REGION | TM_LEAF;
+  region->cells[TM_REGION_FORWARDED].flags = TM_REGION;
+  region->slot_size = TM_REGION_PREFIX + ((heap->object_size + 15) & ~(size_t)15);
+  Tm_Vec_init(&region->remembered);
+  Tm_Vec_init(&region->promoted);
+
+  heap->region = region;
+  return 0;
+
+error:
+  return -1;
+}
+
+TmObjectHeader*
+TmRegion_allocate(TmHeap *heap, int flags)
+{
+  TmRegion *region = heap->region;
+  TmRegionBlock *block = region->blocks;
+
+  if(block == NULL || block->used + region->slot_size > block->size) {
+    size_t bytes = TM_REGION_HEADER + region->slot_size;
+    if(bytes < TM_REGION_BLOCK) bytes = TM_REGION_BLOCK;
+
+    block = malloc(bytes);
+    check_mem(block);
+    block->next = region->blocks;
+    block->used = TM_REGION_HEADER;
+    block->size = bytes;
+    region->blocks = block;
+  }
+
+  char *slot = (char*)block + block->used;
+  block->used += region->slot_size;
+  memset(slot, 0, region->slot_size);
+
+  TmObjectHeader *object = (TmObjectHeader*)(slot + TM_REGION_PREFIX);
+  object->cell = region->cells + (flags & TM_LEAF ? TM_REGION_LEAF : TM_REGION_OBJECT);
+  region->allocated++;
+
+  if(heap->trace) TmTrace_allocate(heap, object, flags);
+
+  return object;
+
+error:
+  return NULL;
+}
+
+void
+TmRegion_write(TmHeap *heap, TmObjectHeader *object, TmObjectHeader *value)
+{
+  TmRegion *region = heap->region;
+  if(value == NULL) return;
+
+  int from_region = in_region(region, object);
+
+  if(in_region(region, value)) {
+    if(from_region) return;
+
+    int count = Tm_Vec_count(&region->remembered);
+    if(count == 0 || Tm_Vec_last(&region->remembered) != object) {
+      Tm_Vec_push(&region->remembered, object);
+    }
+  } else if(from_region) {
+    // Region objects are only scanned when a flip starts, so whatever they
+    // are given afterwards is shaded right away.
+    Tm_shade(heap, value);
+  }
+}
+
+void
+TmRegion_scan(TmHeap *heap, TmCallbackFn callback)
+{
+  TmRegion *region = heap->region;
+
+  for(TmRegionBlock *block = region->blocks; block; block = block->next) {
+    for(size_t at = TM_REGION_HEADER; at < block->used; at += region->slot_size) {
+      TmObjectHeader *object = (TmObjectHeader*)((char*)block + at + TM_REGION_PREFIX);
+      if(object->cell == region->cells + TM_REGION_OBJECT) {
+        heap->scan_pointers(heap, object, callback);
+      }
+    }
+  }
+}
+
+// Heap objects about to be released no longer point into the region.
+void
+TmRegion_forget_dead(TmHeap *heap)
+{
+  TmRegion *region = heap->region;
+  int kept = 0;
+
+  for(int i=0; i < Tm_Vec_count(&region->remembered); i++) {
+    TmObjectHeader *object = Tm_Vec_at(&region->remembered, i);
+    if(!object->cell->ecru) Tm_Vec_at(&region->remembered, kept++) = object;
+  }
+
+  region->remembered.end = kept;
+}
+
+static TmObjectHeader*
+promote(TmHeap *heap, TmObjectHeader *object)
+{
+  TmRegion *region = heap->region;
+
+  if(object == NULL || !in_region(region, object)) return object;
+  if(object->cell == region->cells + TM_REGION_FORWARDED) return FORWARD(object);
+
+  int leaf = object->cell == region->cells + TM_REGION_LEAF;
+  TmObjectHeader *copy = TmHeap_promote(heap, object, leaf ? TM_LEAF : 0);
+  if(copy == NULL) {
+    region->failed = 1;
+    return NULL;
+  }
+
+  FORWARD(object) = copy;
+  object->cell = region->cells + TM_REGION_FORWARDED;
+  region->survivors++;
+
+  if(!leaf && Tm_Vec_push(&region->promoted, copy) != 0) region->failed = 1;
+  return copy;
+}
+
+// Copies are black, so what they point to has to be shaded now that the
+// region doesn't keep it alive anymore.
+static void
+update_slot(TmHeap *heap, TmObjectHeader **slot)
+{
+  *slot = promote(heap, *slot);
+  if(*slot) Tm_shade(heap, *slot);
+}
+
+// Objects left behind are gone for the trace too, or their addresses would
+// be mistaken for them once the blocks are reused.
+static void
+trace_dropped(TmHeap *heap)
+{
+  TmRegion *region = heap->region;
+
+  for(TmRegionBlock *block = region->blocks; block; block = block->next) {
+    for(size_t at = TM_REGION_HEADER; at < block->used; at += region->slot_size) {
+      TmObjectHeader *object = (TmObjectHeader*)((char*)block + at + TM_REGION_PREFIX);
+      if(object->cell != region->cells + TM_REGION_FORWARDED) TmTrace_release(heap, object);
+    }
+  }
+}
+
+int
+Tm_region_end(TmHeap *heap, Tm_DArray *escaping)
+{
+  TmRegion *region = heap->region;
+  check(region != NULL, "There's no region to end.");
+
+  debug("[GC] Ending region (%i objects)", region->allocated);
+
+  if(escaping) {
+    for(int i=0; i < Tm_DArray_count(escaping); i++) {
+      Tm_DArray_set(escaping, i, promote(heap, Tm_DArray_at(escaping, i)));
+    }
+  }
+
+  for(int i=0; i < Tm_Vec_count(&region->remembered); i++) {
+    heap->scan_slots(heap, Tm_Vec_at(&region->remembered, i), update_slot);
+  }
+
+  // Copies still point at the originals of whatever they point to.
+  while(Tm_Vec_count(&region->promoted) > 0) {
+    heap->scan_slots(heap, Tm_Vec_pop(&region->promoted), update_slot);
+  }
+
+  if(heap->trace) trace_dropped(heap);
+
+  int survivors = region->survivors;
+  int failed = region->failed;
+  TmRegion_destroy(heap);
+
+  if(failed) log_err("Some region objects couldn't be promoted.");
+  return failed ? -1 : survivors;
+
+error:
+  return -1;
+}
+
+void
+TmRegion_destroy(TmHeap *heap)
+{
+  TmRegion *region = heap->region;
+
+  while(region->blocks) {
+    TmRegionBlock *block = region->blocks;
+    region->blocks = block->next;
+    free(block);
+  }
+
+  Tm_Vec_free(&region->remembered);
+  Tm_Vec_free(&region->promoted);
+  free(region);
+  heap->region = NULL;
+}
@@ -0,0 +1,100 @@
+#include <treadmill/site.h>
+
+TmSite*
+TmHeap_site(TmHeap *heap, int site)
+{
+  check(site >= 0, "Sites can't be negative.");
+
+  if(heap->sites == NULL) {
+    heap->sites = calloc(1, sizeof(TmSites));
+    check_mem(heap->sites);
+  }
+
+  TmSites *sites = heap->sites;
+  while(Tm_Vec_count(&sites->sites) <= site) {
+    TmSite fresh = { TM_SITE_UNDECIDED, 0, 0, 0 };
+    check_mem(Tm_Vec_push(&sites->sites, fresh) == 0);
+  }
+
+  return &Tm_Vec_at(&sites->sites, site);
+
+error:
+  return NULL;
+}
+
+TmObjectHeader*
+Tm_allocate_site(TmHeap *heap, int site, int flags)
+{
+  TmSite *entry = TmHeap_site(heap, site);
+  if(entry == NULL) return Tm_allocate_flags(heap, flags);
+
+  if(entry->state == TM_SITE_PRETENURED) return Tm_allocate_hint(heap, flags | TM_LONG_LIVED);
+
+  TmObjectHeader *object = Tm_allocate_flags(heap, flags);
+  if(object == NULL || entry->state != TM_SITE_UNDECIDED) return object;
+
+  // Immortals and region objects tell nothing about the site.
+  if(object->cell->flags & (TM_IMMORTAL | TM_REGION)) return object;
+
+  if(entry->allocations++ % TM_SITE_SAMPLE_EVERY == 0) {
+    TmSiteSample sample = { object, site, 0 };
+    Tm_Vec_push(&heap->sites->samples, sample);
+  }
+
+  return object;
+}
+
+static inline void
+settle(TmSite *site)
+{
+  int settled = site->survivors + site->deaths;
+  if(site->state != TM_SITE_UNDECIDED || settled < TM_SITE_SAMPLES) return;
+
+  if(site->survivors * 100 >= settled * TM_SITE_SURVIVAL) {
+    site->state = TM_SITE_PRETENURED;
+  } else {
+    site->state = TM_SITE_YOUNG;
+  }
+}
+
+/*
+ * Samples still ecru are about to be released. The others survived one more
+ * flip.
+ */
+void
+TmHeap_age_sites(TmHeap *heap)
+{
+  TmSites *sites = heap->sites;
+  if(sites == NULL) return;
+
+  int kept = 0;
+  for(int i=0; i < Tm_Vec_count(&sites->samples); i++) {
+    TmSiteSample sample = Tm_Vec_at(&sites->samples, i);
+    TmSite *site = &Tm_Vec_at(&sites->sites, sample.site);
+
+    if(sample.object->cell->ecru) {
+      site->deaths++;
+    } else if(++sample.flips >= TM_SITE_AGE) {
+      site->survivors++;
+    } else {
+      Tm_Vec_at(&sites->samples, kept++) = sample;
+      continue;
+    }
+
+    settle(site);
+  }
+
+  sites->samples.end = kept;
+}
+
+void
+TmHeap_destroy_sites(TmHeap *heap)
+{
+  TmSites *sites = heap->sites;
+  if(sites == NULL) return;
+
+  Tm_Vec_free(&sites->sites);
+  Tm_Vec_free(&sites->samples);
+  free(sites);
+  heap->sites = NULL;
+}
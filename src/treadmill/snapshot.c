@@ -0,0 +1,132 @@
+#include <unistd.h>
+#include <treadmill/snapshot.h>
+
+typedef struct tm_snapshot_s {
+  int fd;
+  int failed;
+  size_t used;
+  unsigned char buffer[TM_SNAPSHOT_BUFFER];
+} TmSnapshot;
+
+static inline void
+TmSnapshot_flush(TmSnapshot *snapshot)
+{
+  size_t done = 0;
+
+  while(!snapshot->failed && done < snapshot->used) {
+    ssize_t written = write(snapshot->fd, snapshot->buffer + done, snapshot->used - done);
+    if(written < 0) {
+      log_err("Failed to write heap snapshot.");
+      snapshot->failed = 1;
+    } else {
+      done += written;
+    }
+  }
+
+  snapshot->used = 0;
+}
+
+static inline void
+TmSnapshot_write(TmSnapshot *snapshot, const void *data, size_t size)
+{
+  if(snapshot->used + size > TM_SNAPSHOT_BUFFER) TmSnapshot_flush(snapshot);
+
+  memcpy(snapshot->buffer + snapshot->used, data, size);
+  snapshot->used += size;
+}
+
+static inline void
+TmSnapshot_record(TmSnapshot *snapshot, unsigned char tag, void *object)
+{
+  uint64_t id = (uint64_t)(uintptr_t)object;
+  TmSnapshot_write(snapshot, &tag, sizeof(tag));
+  TmSnapshot_write(snapshot, &id, sizeof(id));
+}
+
+static void
+TmSnapshot_edge(TmHeap *heap, TmObjectHeader *object)
+{
+  TmSnapshot_record(heap->snapshot, TM_SNAPSHOT_EDGE, object);
+}
+
+static inline void
+TmSnapshot_node(TmHeap *heap, TmCell *cell, TmColour colour)
+{
+  TmSnapshot *snapshot = heap->snapshot;
+  unsigned char c = colour;
+  uint64_t size = heap->object_size;
+
+  TmSnapshot_record(snapshot, TM_SNAPSHOT_NODE, cell->value);
+  TmSnapshot_write(snapshot, &c, sizeof(c));
+  TmSnapshot_write(snapshot, &size, sizeof(size));
+
+  if(!(cell->flags & TM_LEAF)) {
+    heap->scan_pointers(heap, cell->value, TmSnapshot_edge);
+  }
+}
+
+static inline void
+TmSnapshot_region(TmHeap *heap, TmCell *from, TmCell *to, TmColour colour)
+{
+  TmCell *ptr = from;
+  while(ptr != to) {
+    TmSnapshot_node(heap, ptr, colour);
+    ptr = TmCell_next(heap, ptr);
+  }
+}
+
+int
+TmHeap_snapshot(TmHeap *heap, int fd)
+{
+  TmSnapshot *snapshot = malloc(sizeof(TmSnapshot));
+  check_mem(snapshot);
+
+  snapshot->fd     = fd;
+  snapshot->failed = 0;
+  snapshot->used   = 0;
+  heap->snapshot   = snapshot;
+
+  uint32_t magic   = TM_SNAPSHOT_MAGIC;
+  uint32_t version = TM_SNAPSHOT_VERSION;
+  uint64_t size    = heap->object_size;
+  TmSnapshot_write(snapshot, &magic, sizeof(magic));
+  TmSnapshot_write(snapshot, &version, sizeof(version));
+  TmSnapshot_write(snapshot, &size, sizeof(size));
+
+  Tm_DArray *rootset = heap->state->rootset(heap->state);
+  for(int i=0; i < Tm_DArray_count(rootset); i++) {
+    TmSnapshot_record(snapshot, TM_SNAPSHOT_ROOT, Tm_DArray_at(rootset, i));
+  }
+  Tm_DArray_destroy(rootset);
+
+  // Immortal objects are roots in their own right.
+  TmCell *ptr = heap->immortal;
+  for(int i=0; i < heap->immortals; i++) {
+    TmSnapshot_record(snapshot, TM_SNAPSHOT_ROOT, ptr->value);
+    ptr = TmCell_next(heap, ptr);
+  }
+
+  // -(bottom)- ECRU -(top)- GREY -(scan)- BLACK -(free)- WHITE ...
+  TmSnapshot_region(heap, heap->bottom, heap->top, TM_ECRU);
+  TmSnapshot_region(heap, heap->top, heap->scan, TM_GREY);
+  TmSnapshot_region(heap, heap->scan, heap->free, TM_BLACK);
+
+  ptr = heap->immortal;
+  for(int i=0; i < heap->immortals; i++) {
+    TmSnapshot_node(heap, ptr, TM_BLACK);
+    ptr = TmCell_next(heap, ptr);
+  }
+
+  unsigned char end = TM_SNAPSHOT_END;
+  TmSnapshot_write(snapshot, &end, sizeof(end));
+  TmSnapshot_flush(snapshot);
+
+  int failed = snapshot->failed;
+  heap->snapshot = NULL;
+  free(snapshot);
+
+  return failed ? -1 : 0;
+
+error:
+  return -1;
+}
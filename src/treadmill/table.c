@@ -0,0 +1,134 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <treadmill/_dbg.h>
+#include <treadmill/table.h>
+
+static inline unsigned int
+slot_of(TmTable *table, const void *key)
+{
+  uintptr_t hash = (uintptr_t)key >> 4;
+  hash *= (uintptr_t)0x9e3779b97f4a7c15ULL;
+  return (unsigned int)(hash >> 16) & (table->capacity - 1);
+}
+
+static int
+resize(TmTable *table, int capacity)
+{
+  void **keys = table->keys;
+  void **values = table->values;
+  int old_capacity = table->capacity;
+
+  table->keys   = calloc(capacity, sizeof(void*));
+  table->values = calloc(capacity, sizeof(void*));
+  check_mem(table->keys && table->values);
+
+  table->capacity = capacity;
+  table->used     = table->count;
+
+  for(int i=0; i < old_capacity; i++) {
+    if(keys[i] == NULL || keys[i] == TM_TABLE_TOMBSTONE) continue;
+
+    unsigned int j = slot_of(table, keys[i]);
+    while(table->keys[j]) j = (j + 1) & (capacity - 1);
+    table->keys[j]   = keys[i];
+    table->values[j] = values[i];
+  }
+
+  free(keys);
+  free(values);
+  return 0;
+
+error:
+  free(table->keys);
+  free(table->values);
+  table->keys     = keys;
+  table->values   = values;
+  table->capacity = old_capacity;
+  return -1;
+}
+
+int
+TmTable_init(TmTable *table, int count)
+{
+  int capacity = TM_TABLE_MIN;
+  while(capacity < count * 2) capacity *= 2;
+
+  table->keys   = NULL;
+  table->values = NULL;
+  table->capacity = 0;
+  table->count    = 0;
+  table->used     = 0;
+  return resize(table, capacity);
+}
+
+int
+TmTable_find(TmTable *table, const void *key)
+{
+  if(table->capacity == 0) return -1;
+
+  unsigned int mask = table->capacity - 1;
+  unsigned int i = slot_of(table, key);
+
+  while(table->keys[i]) {
+    if(table->keys[i] == key) return i;
+    i = (i + 1) & mask;
+  }
+
+  return -1;
+}
+
+int
+TmTable_insert(TmTable *table, void *key)
+{
+  int found = TmTable_find(table, key);
+  if(found >= 0) return found;
+
+  // Keep at least half of the slots empty so probes stay short. When most
+  // of the others are tombstones, resizing in place clears them.
+  if((table->used + 1) * 2 > table->capacity) {
+    int capacity = table->capacity ? table->capacity : TM_TABLE_MIN;
+    if(table->count * 4 > table->capacity) capacity *= 2;
+    check(resize(table, capacity) == 0, "Failed to grow a table.");
+  }
+
+  unsigned int mask = table->capacity - 1;
+  unsigned int i = slot_of(table, key);
+  while(table->keys[i] && table->keys[i] != TM_TABLE_TOMBSTONE) i = (i + 1) & mask;
+
+  if(table->keys[i] == NULL) table->used++;
+  table->keys[i]   = key;
+  table->values[i] = NULL;
+  table->count++;
+
+  return i;
+
+error:
+  return -1;
+}
+
+void*
+TmTable_get(TmTable *table, const void *key)
+{
+  int found = TmTable_find(table, key);
+  return found >= 0 ? table->values[found] : NULL;
+}
+
+void
+TmTable_remove_at(TmTable *table, int slot)
+{
+  table->keys[slot]   = TM_TABLE_TOMBSTONE;
+  table->values[slot] = NULL;
+  table->count--;
+}
+
+void
+TmTable_free(TmTable *table)
+{
+  free(table->keys);
+  free(table->values);
+  table->keys     = NULL;
+  table->values   = NULL;
+  table->capacity = 0;
+  table->count    = 0;
+  table->used     = 0;
+}
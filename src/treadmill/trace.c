@@ -0,0 +1,400 @@
+#include <unistd.h>
+#include <treadmill/trace.h>
+#include <treadmill/table.h>
+
+/*
+ * The recorder numbers objects as they are allocated and finds those
+ * numbers again through a table keyed by address. Numbers are kept as the
+ * table's values, so they are as wide as a pointer.
+ */
+typedef struct tm_trace_s {
+  int fd;
+  int failed;
+  size_t used;
+  uint64_t next_id;
+
+  TmTable ids;
+
+  // The object whose pointers are being recorded when tracing starts.
+  uint64_t scanning;
+  uint64_t field;
+
+  unsigned char buffer[TM_TRACE_BUFFER];
+} TmTrace;
+
+static inline void
+TmTrace_flush(TmTrace *trace)
+{
+  size_t done = 0;
+
+  while(!trace->failed && done < trace->used) {
+    ssize_t written = write(trace->fd, trace->buffer + done, trace->used - done);
+    if(written < 0) {
+      log_err("Failed to write allocation trace.");
+      trace->failed = 1;
+    } else {
+      done += written;
+    }
+  }
+
+  trace->used = 0;
+}
+
+static inline void
+TmTrace_bytes(TmTrace *trace, const void *data, size_t size)
+{
+  if(trace->used + size > TM_TRACE_BUFFER) TmTrace_flush(trace);
+
+  memcpy(trace->buffer + trace->used, data, size);
+  trace->used += size;
+}
+
+static inline void
+TmTrace_tag(TmTrace *trace, unsigned char tag)
+{
+  if(trace->used + 1 > TM_TRACE_BUFFER) TmTrace_flush(trace);
+  trace->buffer[trace->used++] = tag;
+}
+
+static inline void
+TmTrace_varint(TmTrace *trace, uint64_t value)
+{
+  if(trace->used + 10 > TM_TRACE_BUFFER) TmTrace_flush(trace);
+
+  while(value >= 0x80) {
+    trace->buffer[trace->used++] = (unsigned char)(value | 0x80);
+    value >>= 7;
+  }
+  trace->buffer[trace->used++] = (unsigned char)value;
+}
+
+static uint64_t
+TmTrace_id_of(TmTrace *trace, TmObjectHeader *object)
+{
+  if(object == NULL) return 0;
+  return (uintptr_t)TmTable_get(&trace->ids, object);
+}
+
+static uint64_t
+TmTrace_bind(TmTrace *trace, TmObjectHeader *object, uint64_t id)
+{
+  int i = TmTable_insert(&trace->ids, object);
+  if(i < 0) return 0;
+
+  trace->ids.values[i] = (void*)(uintptr_t)id;
+  return id;
+}
+
+static uint64_t
+TmTrace_number(TmTrace *trace, TmObjectHeader *object)
+{
+  uint64_t id = TmTrace_bind(trace, object, trace->next_id);
+  if(id) trace->next_id++;
+  return id;
+}
+
+static uint64_t
+TmTrace_forget(TmTrace *trace, TmObjectHeader *object)
+{
+  int i = TmTable_find(&trace->ids, object);
+  if(i < 0) return 0;
+
+  uint64_t id = (uintptr_t)trace->ids.values[i];
+  TmTable_remove_at(&trace->ids, i);
+  return id;
+}
+
+static inline void
+TmTrace_record_allocation(TmTrace *trace, TmObjectHeader *object, int flags)
+{
+  if(TmTrace_number(trace, object) == 0) return;
+
+  TmTrace_tag(trace, TM_TRACE_ALLOCATE);
+  TmTrace_varint(trace, flags);
+}
+
+static void
+TmTrace_edge(TmHeap *heap, TmObjectHeader *object)
+{
+  TmTrace *trace = heap->trace;
+
+  TmTrace_tag(trace, TM_TRACE_WRITE);
+  TmTrace_varint(trace, trace->scanning);
+  TmTrace_varint(trace, trace->field++);
+  TmTrace_varint(trace, TmTrace_id_of(trace, object));
+}
+
+static inline void
+TmTrace_existing(TmHeap *heap, TmCell *from, TmCell *to, int count, int edges)
+{
+  TmTrace *trace = heap->trace;
+  TmCell *ptr = from;
+
+  for(int i=0; count < 0 ? ptr != to : i < count; i++) {
+    if(!edges) {
+      TmTrace_record_allocation(trace, ptr->value, ptr->flags);
+    } else if(!(ptr->flags & TM_LEAF)) {
+      trace->scanning = TmTrace_id_of(trace, ptr->value);
+      trace->field = 0;
+      heap->scan_pointers(heap, ptr->value, TmTrace_edge);
+    }
+    ptr = TmCell_next(heap, ptr);
+  }
+}
+
+int
+TmTrace_start(TmHeap *heap, int fd)
+{
+  TmTrace *trace = NULL;
+  check(heap->trace == NULL, "The heap is already being traced.");
+
+  trace = calloc(1, sizeof(TmTrace));
+  check_mem(trace);
+
+  trace->fd      = fd;
+  trace->next_id = 1;
+  check(TmTable_init(&trace->ids, 512) == 0, "Failed to allocate the trace's object table.");
+  heap->trace = trace;
+
+  uint32_t magic   = TM_TRACE_MAGIC;
+  uint32_t version = TM_TRACE_VERSION;
+  uint64_t size    = heap->object_size;
+  TmTrace_bytes(trace, &magic, sizeof(magic));
+  TmTrace_bytes(trace, &version, sizeof(version));
+  TmTrace_bytes(trace, &size, sizeof(size));
+
+  // Number everything first, so pointers between existing objects resolve.
+  // -(bottom)- ECRU -(top)- GREY -(scan)- BLACK -(free)- WHITE ...
+  for(int edges = 0; edges < 2; edges++) {
+    TmTrace_existing(heap, heap->bottom, heap->free, -1, edges);
+    TmTrace_existing(heap, heap->immortal, NULL, heap->immortals, edges);
+  }
+
+  if(trace->failed) {
+    TmTrace_stop(heap);
+    return -1;
+  }
+  return 0;
+
+error:
+  if(trace) free(trace);
+  return -1;
+}
+
+int
+TmTrace_stop(TmHeap *heap)
+{
+  TmTrace *trace = heap->trace;
+  check(trace != NULL, "The heap isn't being traced.");
+
+  TmTrace_tag(trace, TM_TRACE_END);
+  TmTrace_flush(trace);
+
+  int failed = trace->failed;
+  heap->trace = NULL;
+  TmTable_free(&trace->ids);
+  free(trace);
+
+  return failed ? -1 : 0;
+
+error:
+  return -1;
+}
+
+void
+TmTrace_allocate(TmHeap *heap, TmObjectHeader *object, int flags)
+{
+  TmTrace_record_allocation(heap->trace, object, flags);
+}
+
+// Copies keep the number of the object they were made from, if it had one.
+void
+TmTrace_promote(TmHeap *heap, TmObjectHeader *object, TmObjectHeader *copy, int flags)
+{
+  TmTrace *trace = heap->trace;
+  uint64_t id = TmTrace_forget(trace, object);
+
+  if(id == 0 || TmTrace_bind(trace, copy, id) == 0) {
+    TmTrace_record_allocation(trace, copy, flags);
+  }
+}
+
+void
+TmTrace_write(TmHeap *heap, TmObjectHeader *object, uintptr_t field, TmObjectHeader *value)
+{
+  TmTrace *trace = heap->trace;
+  uint64_t id = TmTrace_id_of(trace, object);
+  if(id == 0) return;
+
+  TmTrace_tag(trace, TM_TRACE_WRITE);
+  TmTrace_varint(trace, id);
+  TmTrace_varint(trace, field);
+  TmTrace_varint(trace, TmTrace_id_of(trace, value));
+}
+
+void
+TmTrace_flip(TmHeap *heap)
+{
+  TmTrace_tag(heap->trace, TM_TRACE_FLIP);
+}
+
+void
+TmTrace_roots(TmHeap *heap, Tm_DArray *rootset)
+{
+  TmTrace *trace = heap->trace;
+  int count = Tm_DArray_count(rootset);
+
+  TmTrace_tag(trace, TM_TRACE_ROOTS);
+  TmTrace_varint(trace, count);
+  for(int i=0; i < count; i++) {
+    TmTrace_varint(trace, TmTrace_id_of(trace, Tm_DArray_at(rootset, i)));
+  }
+}
+
+void
+TmTrace_release(TmHeap *heap, void *value)
+{
+  TmTrace *trace = heap->trace;
+  uint64_t id = TmTrace_forget(trace, value);
+  if(id == 0) return;
+
+  TmTrace_tag(trace, TM_TRACE_RELEASE);
+  TmTrace_varint(trace, id);
+}
+
+struct tm_trace_reader_s {
+  int fd;
+  size_t used;
+  size_t length;
+  uint64_t object_size;
+  uint64_t next_id;
+  uint64_t *roots;
+  uint64_t roots_max;
+  unsigned char buffer[TM_TRACE_BUFFER];
+};
+
+// Returns the next byte of the trace, or -1 at its end.
+static inline int
+TmTraceReader_byte(TmTraceReader *reader)
+{
+  if(reader->used == reader->length) {
+    ssize_t got = read(reader->fd, reader->buffer, TM_TRACE_BUFFER);
+    if(got <= 0) return -1;
+    reader->used = 0;
+    reader->length = got;
+  }
+
+  return reader->buffer[reader->used++];
+}
+
+static inline int
+TmTraceReader_varint(TmTraceReader *reader, uint64_t *value)
+{
+  *value = 0;
+
+  for(int shift = 0; shift < 64; shift += 7) {
+    int byte = TmTraceReader_byte(reader);
+    if(byte < 0) return -1;
+
+    *value |= (uint64_t)(byte & 0x7f) << shift;
+    if(!(byte & 0x80)) return 0;
+  }
+
+  return -1;
+}
+
+TmTraceReader*
+TmTraceReader_open(int fd)
+{
+  TmTraceReader *reader = calloc(1, sizeof(TmTraceReader));
+  check_mem(reader);
+  reader->fd = fd;
+  reader->next_id = 1;
+
+  unsigned char header[2 * sizeof(uint32_t) + sizeof(uint64_t)];
+  for(size_t i=0; i < sizeof(header); i++) {
+    int byte = TmTraceReader_byte(reader);
+    check(byte >= 0, "Truncated allocation trace.");
+    header[i] = byte;
+  }
+
+  uint32_t magic, version;
+  memcpy(&magic, header, sizeof(magic));
+  memcpy(&version, header + sizeof(magic), sizeof(version));
+  memcpy(&reader->object_size, header + 2 * sizeof(uint32_t), sizeof(uint64_t));
+
+  check(magic == TM_TRACE_MAGIC, "Not an allocation trace.");
+  check(version == TM_TRACE_VERSION, "Unsupported trace version %u.", version);
+
+  return reader;
+
+error:
+  if(reader) free(reader);
+  return NULL;
+}
+
+uint64_t
+TmTraceReader_object_size(TmTraceReader *reader)
+{
+  return reader->object_size;
+}
+
+int
+TmTraceReader_next(TmTraceReader *reader, TmTraceEvent *event)
+{
+  uint64_t flags = 0;
+  int tag = TmTraceReader_byte(reader);
+  check(tag >= 0, "Truncated allocation trace.");
+
+  memset(event, 0, sizeof(TmTraceEvent));
+  event->type = tag;
+
+  switch(tag) {
+    case TM_TRACE_ALLOCATE:
+      check(TmTraceReader_varint(reader, &flags) == 0, "Truncated allocation trace.");
+      event->flags  = (int)flags;
+      event->object = reader->next_id++;
+      break;
+    case TM_TRACE_WRITE:
+      check(TmTraceReader_varint(reader, &event->object) == 0 &&
+          TmTraceReader_varint(reader, &event->field) == 0 &&
+          TmTraceReader_varint(reader, &event->value) == 0, "Truncated allocation trace.");
+      break;
+    case TM_TRACE_RELEASE:
+      check(TmTraceReader_varint(reader, &event->object) == 0, "Truncated allocation trace.");
+      break;
+    case TM_TRACE_ROOTS:
+      check(TmTraceReader_varint(reader, &event->count) == 0, "Truncated allocation trace.");
+      if(event->count > reader->roots_max) {
+        uint64_t *roots = realloc(reader->roots, event->count * sizeof(uint64_t));
+        check_mem(roots);
+        reader->roots = roots;
+        reader->roots_max = event->count;
+      }
+      for(uint64_t i=0; i < event->count; i++) {
+        check(TmTraceReader_varint(reader, &reader->roots[i]) == 0, "Truncated allocation trace.");
+      }
+      event->roots = reader->roots;
+      break;
+    case TM_TRACE_FLIP:
+      break;
+    case TM_TRACE_END:
+      return 0;
+    default:
+      sentinel("Unknown trace record '%c'.", tag);
+  }
+
+  return 1;
+
+error:
+  return -1;
+}
+
+void
+TmTraceReader_close(TmTraceReader *reader)
+{
+  if(reader) {
+    free(reader->roots);
+    free(reader);
+  }
+}
@@ -0,0 +1,133 @@
+#include <treadmill/weak.h>
+
+static inline int
+is_dead(TmObjectHeader *object)
+{
+  return object->cell->ecru;
+}
+
+TmWeakRef*
+TmWeakRef_new(TmHeap *heap, TmObjectHeader *target)
+{
+  check(!target || !(target->cell->flags & TM_REGION), "Region objects can't be referenced weakly.");
+
+  TmWeakRef *ref = calloc(1, sizeof(TmWeakRef));
+  check_mem(ref);
+
+  ref->target = target;
+  ref->next   = heap->weak_refs;
+  if(heap->weak_refs) heap->weak_refs->prev = ref;
+  heap->weak_refs = ref;
+
+  return ref;
+
+error:
+  return NULL;
+}
+
+/*
+ * The target may be ecru in the middle of a collection. Handing it back to
+ * the mutator makes it reachable again, so it's shaded before returning.
+ */
+TmObjectHeader*
+TmWeakRef_get(TmHeap *heap, TmWeakRef *ref)
+{
+  if(ref->target) Tm_shade(heap, ref->target);
+  return ref->target;
+}
+
+void
+TmWeakRef_destroy(TmHeap *heap, TmWeakRef *ref)
+{
+  if(ref->prev) ref->prev->next = ref->next;
+  else heap->weak_refs = ref->next;
+  if(ref->next) ref->next->prev = ref->prev;
+
+  free(ref);
+}
+
+TmWeakTable*
+TmWeakTable_new(TmHeap *heap, int capacity)
+{
+  TmWeakTable *table = calloc(1, sizeof(TmWeakTable));
+  check_mem(table);
+  check(TmTable_init(&table->entries, capacity) == 0, "Failed to create weak table.");
+
+  table->next = heap->weak_tables;
+  if(heap->weak_tables) heap->weak_tables->prev = table;
+  heap->weak_tables = table;
+
+  return table;
+
+error:
+  if(table) free(table);
+  return NULL;
+}
+
+int
+TmWeakTable_put(TmWeakTable *table, TmObjectHeader *key, void *value)
+{
+  check(!(key->cell->flags & TM_REGION), "Region objects can't be weak keys.");
+
+  int i = TmTable_insert(&table->entries, key);
+  check(i >= 0, "Failed to grow weak table.");
+  table->entries.values[i] = value;
+
+  return 0;
+
+error:
+  return -1;
+}
+
+void*
+TmWeakTable_get(TmWeakTable *table, TmObjectHeader *key)
+{
+  return TmTable_get(&table->entries, key);
+}
+
+void*
+TmWeakTable_remove(TmWeakTable *table, TmObjectHeader *key)
+{
+  int found = TmTable_find(&table->entries, key);
+  if(found < 0) return NULL;
+
+  void *value = table->entries.values[found];
+  TmTable_remove_at(&table->entries, found);
+
+  return value;
+}
+
+void
+TmWeakTable_destroy(TmHeap *heap, TmWeakTable *table)
+{
+  if(table->prev) table->prev->next = table->next;
+  else heap->weak_tables = table->next;
+  if(table->next) table->next->prev = table->prev;
+
+  TmTable_free(&table->entries);
+  free(table);
+}
+
+void
+TmHeap_clear_weak(TmHeap *heap)
+{
+  for(TmWeakRef *ref = heap->weak_refs; ref; ref = ref->next) {
+    if(ref->target && is_dead(ref->target)) ref->target = NULL;
+  }
+
+  for(TmWeakTable *table = heap->weak_tables; table; table = table->next) {
+    TmTable *entries = &table->entries;
+    if(entries->count == 0) continue;
+
+    for(int i=0; i < entries->capacity; i++) {
+      if(TmTable_live(entries, i) && is_dead(entries->keys[i])) TmTable_remove_at(entries, i);
+    }
+  }
+}
+
+void
+TmHeap_destroy_weak(TmHeap *heap)
+{
+  while(heap->weak_refs) TmWeakRef_destroy(heap, heap->weak_refs);
+  while(heap->weak_tables) TmWeakTable_destroy(heap, heap->weak_tables);
+}
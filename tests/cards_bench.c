@@ -0,0 +1,131 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <treadmill/gc.h>
+#include <treadmill/cards.h>
+
+/*
+ * Times the rescans of a large array written to after it was scanned, with
+ * and without card marking: each round stores a few fresh objects into
+ * random slots and scans until nothing is grey.
+ *
+ *   $ tests/cards_bench [slots [writes]]
+ */
+
+typedef struct state_s {
+  TmStateHeader gc;
+  TmObjectHeader *root;
+} State;
+
+typedef struct object_s {
+  TmObjectHeader gc;
+  int count;
+  struct object_s **slots;
+} Object;
+
+static Tm_DArray*
+bench_rootset(TmStateHeader *state_h)
+{
+  Tm_DArray *rootset = Tm_DArray_create(sizeof(TmObjectHeader*), 1);
+  Tm_DArray_push(rootset, ((State*)state_h)->root);
+  return rootset;
+}
+
+static void
+bench_scan_pointers(TmHeap *heap, TmObjectHeader *object, TmCallbackFn callback)
+{
+  Object *self = (Object*)object;
+  for(int i=0; i < self->count; i++) {
+    if(self->slots[i]) callback(heap, (TmObjectHeader*)self->slots[i]);
+  }
+}
+
+static void
+bench_scan_range(TmHeap *heap, TmObjectHeader *object, size_t from, size_t to, TmCallbackFn callback)
+{
+  Object *self = (Object*)object;
+  for(size_t i = from / sizeof(Object*); i < to / sizeof(Object*); i++) {
+    if(self->slots[i]) callback(heap, (TmObjectHeader*)self->slots[i]);
+  }
+}
+
+static void
+bench_release(void *value)
+{
+  Object *self = (Object*)value;
+  if(self->slots) free(self->slots);
+  free(self);
+}
+
+static unsigned long long seed = 88172645463325252ULL;
+
+static int
+random_below(int n)
+{
+  seed ^= seed << 13;
+  seed ^= seed >> 7;
+  seed ^= seed << 17;
+  return (int)(seed % n);
+}
+
+static double
+now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double
+run(int slots, int writes, int rounds, int cards)
+{
+  State state = { .gc = { .rootset = bench_rootset } };
+  TmHeap *heap = TmHeap_new((TmStateHeader*)&state, 1000, 1000, 1 << 30,
+    sizeof(Object), bench_release, bench_scan_pointers);
+  if(cards) heap->scan_range = bench_scan_range;
+
+  Object *array = (Object*)Tm_allocate(heap);
+  array->count = slots;
+  array->slots = calloc(slots, sizeof(Object*));
+  TmHeap_track_cards(heap, (TmObjectHeader*)array, slots * sizeof(Object*));
+  state.root = (TmObjectHeader*)array;
+
+  for(int i=0; i < slots; i++) array->slots[i] = (Object*)Tm_allocate(heap);
+  Tm_flip(heap);
+  Tm_scan_all(heap);
+
+  double elapsed = 0;
+  for(int round=0; round < rounds; round++) {
+    for(int i=0; i < writes; i++) {
+      int slot = random_below(slots);
+      array->slots[slot] = (Object*)Tm_allocate(heap);
+      Tm_write_barrier(heap, (TmObjectHeader*)array, slot * sizeof(Object*),
+        (TmObjectHeader*)array->slots[slot]);
+    }
+
+    double t0 = now();
+    Tm_scan_all(heap);
+    elapsed += now() - t0;
+  }
+
+  TmHeap_destroy(heap);
+  return elapsed;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int slots  = argc > 1 ? atoi(argv[1]) : 1000000;
+  int writes = argc > 2 ? atoi(argv[2]) : 16;
+  int rounds = 100;
+
+  double whole = run(slots, writes, rounds, 0);
+  double dirty = run(slots, writes, rounds, 1);
+
+  printf("array:    %i slots, %i writes per rescan, %i rescans\n", slots, writes, rounds);
+  printf("whole:    %8.3f s (scan_pointers)\n", whole);
+  printf("cards:    %8.3f s (scan_range over dirty cards)\n", dirty);
+
+  return 0;
+}
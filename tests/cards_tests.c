@@ -0,0 +1,179 @@
+#include "minunit.h"
+#define FIXTURE_SETUP use_ranges
+#include "fixture.h"
+#include <treadmill/cards.h>
+
+#define SLOTS 1024
+
+typedef struct object_s {
+  TmObjectHeader gc;
+  struct object_s **slots; // SLOTS of them, or none
+} Object;
+
+static int full_scans = 0;
+static int range_scans = 0;
+static int range_slots = 0;
+
+void
+test_scan_pointers(TmHeap *heap, TmObjectHeader *object, TmCallbackFn callback)
+{
+  Object *self = (Object*)object;
+  if(self->slots == NULL) return;
+
+  full_scans++;
+  for(int i=0; i < SLOTS; i++) {
+    if(self->slots[i]) callback(heap, (TmObjectHeader*)self->slots[i]);
+  }
+}
+
+void
+test_scan_range(TmHeap *heap, TmObjectHeader *object, size_t from, size_t to, TmCallbackFn callback)
+{
+  Object *self = (Object*)object;
+
+  range_scans++;
+  for(size_t i = from / sizeof(Object*); i < to / sizeof(Object*); i++) {
+    range_slots++;
+    if(self->slots[i]) callback(heap, (TmObjectHeader*)self->slots[i]);
+  }
+}
+
+void
+test_release(void *value)
+{
+  Object *self = (Object*)value;
+  released++;
+  if(self->slots) free(self->slots);
+  free(self);
+}
+
+static void
+use_ranges(TmHeap *heap)
+{
+  heap->scan_range = test_scan_range;
+  full_scans = range_scans = range_slots = 0;
+}
+
+static Object*
+Array_new(TmHeap *heap)
+{
+  Object *array = (Object*)Tm_allocate(heap);
+  array->slots = calloc(SLOTS, sizeof(Object*));
+  TmHeap_track_cards(heap, (TmObjectHeader*)array, SLOTS * sizeof(Object*));
+  return array;
+}
+
+static void
+Array_set(TmHeap *heap, Object *array, int i, Object *value)
+{
+  array->slots[i] = value;
+  Tm_write_barrier(heap, (TmObjectHeader*)array, i * sizeof(Object*), (TmObjectHeader*)value);
+}
+
+char *test_cards_rescan_dirty()
+{
+  State *state = State_new();
+  TmHeap *heap = test_heap(state, 10, 1000);
+
+  Object *array = Array_new(heap);
+  Tm_DArray_push(state->registers, array);
+  Object *child = (Object*)Tm_allocate(heap);
+
+  // The array is black after this, the child is ecru: only this function
+  // knows about it.
+  Tm_flip(heap);
+  Tm_scan_all(heap);
+  mu_assert(child->gc.cell->ecru, "The child should be ecru.");
+  int scans = full_scans;
+
+  Array_set(heap, array, 700, child);
+  Array_set(heap, array, 701, child);
+  mu_assert(TmHeap_grey_size(heap) == 1, "Writing to the array should make it grey again.");
+
+  Tm_scan_all(heap);
+  mu_assert(full_scans == scans, "Only the dirty card should be scanned.");
+  mu_assert(range_scans == 1 && range_slots == TM_CARD_BYTES / sizeof(Object*),
+    "Only the dirty card should be scanned.");
+  mu_assert(!child->gc.cell->ecru, "The child should be reachable.");
+
+  Tm_flip(heap);
+  mu_assert(released == 0, "The child should survive.");
+
+  Tm_flip(heap);
+  Tm_scan_all(heap);
+  mu_assert(released == 0, "The child should survive.");
+  mu_assert(full_scans == scans + 2, "Tracked objects should be scanned whole once per collection.");
+
+  TmHeap_destroy(heap);
+  State_destroy(state);
+  return NULL;
+}
+
+char *test_cards_without_scan_range()
+{
+  State *state = State_new();
+  TmHeap *heap = test_heap(state, 10, 1000);
+  heap->scan_range = NULL;
+
+  Object *array = Array_new(heap);
+  Tm_DArray_push(state->registers, array);
+  Object *child = (Object*)Tm_allocate(heap);
+
+  Tm_flip(heap);
+  Tm_scan_all(heap);
+  int scans = full_scans;
+  Array_set(heap, array, 3, child);
+  // Past the tracked size: the whole object is scanned again.
+  Tm_write_barrier(heap, (TmObjectHeader*)array, SLOTS * sizeof(Object*), (TmObjectHeader*)child);
+  Tm_scan_all(heap);
+
+  mu_assert(full_scans == scans + 1, "Arrays should be scanned whole without scan_range.");
+  mu_assert(!child->gc.cell->ecru, "The child should be reachable.");
+
+  TmHeap_destroy(heap);
+  State_destroy(state);
+  return NULL;
+}
+
+char *test_cards_track()
+{
+  State *state = State_new();
+  TmHeap *heap = test_heap(state, 10, 1000);
+
+  Object *leaf = (Object*)Tm_allocate_flags(heap, TM_LEAF);
+  mu_assert(TmHeap_track_cards(heap, (TmObjectHeader*)leaf, 64) == -1,
+    "Leaves shouldn't be tracked.");
+
+  Object *array = Array_new(heap);
+  TmCards *cards = TmHeap_cards(heap, (TmObjectHeader*)array);
+  mu_assert(cards && cards->size == SLOTS * sizeof(Object*), "The array should be tracked.");
+  mu_assert(array->gc.cell->flags & TM_CARDS, "Tracked objects should be flagged.");
+
+  mu_assert(TmHeap_track_cards(heap, (TmObjectHeader*)array, 10 * TM_CARD_BYTES) == 0,
+    "Couldn't resize the cards.");
+  cards = TmHeap_cards(heap, (TmObjectHeader*)array);
+  mu_assert(cards->size == 10 * TM_CARD_BYTES, "The cards should be resized.");
+
+  for(int i=0; i < 100; i++) Array_new(heap);
+  Tm_flip(heap);
+  Tm_flip(heap);
+
+  mu_assert(released == 102, "Unreachable objects should be released.");
+  mu_assert(heap->cards->count == 0, "Released arrays should be forgotten.");
+
+  TmHeap_destroy(heap);
+  State_destroy(state);
+  return NULL;
+}
+
+char *all_tests() {
+  mu_suite_start();
+
+  mu_run_test(test_cards_rescan_dirty);
+  mu_run_test(test_cards_without_scan_range);
+  mu_run_test(test_cards_track);
+
+  return NULL;
+}
+
+RUN_TESTS(all_tests);
@@ -0,0 +1,76 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <treadmill/darray.h>
+
+/*
+ * Times the array patterns the collector leans on: filling and draining a
+ * large array, building many tiny ones like the rootset of every flip, and
+ * pushing and popping around a size boundary. The typed vector does the
+ * same fill and drain with its elements stored inline.
+ *
+ *   $ tests/darray_bench [elements]
+ */
+
+static double
+now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int elements = argc > 1 ? atoi(argv[1]) : 10000000;
+  int tiny     = elements / 4;
+  long sum     = 0;
+
+  double t0 = now();
+  Tm_DArray *array = Tm_DArray_create(sizeof(long), 1);
+  for(long i=0; i < elements; i++) Tm_DArray_push(array, (void*)i);
+  double t1 = now();
+  while(Tm_DArray_count(array) > 0) sum += (long)Tm_DArray_pop(array);
+  double t2 = now();
+
+  for(long i=0; i < elements / 2 + 1; i++) Tm_DArray_push(array, (void*)i);
+  double t3 = now();
+  for(int i=0; i < elements; i++) {
+    Tm_DArray_push(array, (void*)array);
+    sum += (long)Tm_DArray_pop(array) & 1;
+  }
+  double t4 = now();
+  Tm_DArray_destroy(array);
+
+  double t5 = now();
+  for(int i=0; i < tiny; i++) {
+    Tm_DArray *roots = Tm_DArray_create(sizeof(void*), 4);
+    Tm_DArray_push(roots, &sum);
+    Tm_DArray_push(roots, &sum);
+    sum += Tm_DArray_count(roots);
+    Tm_DArray_destroy(roots);
+  }
+  double t6 = now();
+
+  Tm_Vec(long) vec;
+  Tm_Vec_init(&vec);
+  double t7 = now();
+  for(long i=0; i < elements; i++) Tm_Vec_push(&vec, i);
+  double t8 = now();
+  while(Tm_Vec_count(&vec) > 0) sum += Tm_Vec_pop(&vec);
+  double t9 = now();
+  Tm_Vec_free(&vec);
+
+  printf("elements:  %i\n", elements);
+  printf("push:      %8.3f s\n", t1 - t0);
+  printf("pop:       %8.3f s\n", t2 - t1);
+  printf("boundary:  %8.3f s (%i push/pop pairs)\n", t4 - t3, elements);
+  printf("tiny:      %8.3f s (%i arrays of 2)\n", t6 - t5, tiny);
+  printf("vec push:  %8.3f s\n", t8 - t7);
+  printf("vec pop:   %8.3f s\n", t9 - t8);
+
+  // Keeps the loops from being optimized away.
+  return sum == 42 ? 1 : 0;
+}
@@ -92,7 +92,7 @@ char *test_push_pop()
     Tm_DArray_push(array, val);
   }
 
-  mu_assert(array->max == 1201, "Wrong max size.");
+  mu_assert(array->max == 1204, "Should grow geometrically.");
 
   for(i = 999; i >= 0; i--) {
     int *val = Tm_DArray_pop(array);
@@ -101,6 +101,80 @@ char *test_push_pop()
     Tm_DArray_free(val);
   }
 
+  mu_assert(array->max == 301, "Should shrink back once mostly empty.");
+
+  return NULL;
+}
+
+char *test_shrink_hysteresis()
+{
+  Tm_DArray *numbers = Tm_DArray_create(sizeof(int), 100);
+  int i = 0;
+
+  for(i = 0; i < 1000; i++) Tm_DArray_push(numbers, &i);
+  int max = numbers->max;
+
+  // Popping and pushing around the last boundary shouldn't reallocate.
+  for(i = 0; i < 100; i++) {
+    Tm_DArray_pop(numbers);
+    Tm_DArray_push(numbers, &i);
+    mu_assert(numbers->max == max, "Shouldn't resize around a boundary.");
+  }
+
+  while(Tm_DArray_count(numbers) > max / 4) Tm_DArray_pop(numbers);
+  mu_assert(numbers->max == max, "Shouldn't shrink until a quarter full.");
+
+  Tm_DArray_pop(numbers);
+  mu_assert(numbers->max == max / 2, "Should halve once a quarter full.");
+
+  Tm_DArray_destroy(numbers);
+  return NULL;
+}
+
+char *test_small()
+{
+  int values[20];
+  int i = 0;
+  Tm_DArray *small = Tm_DArray_create(sizeof(int), 4);
+
+  mu_assert(small->contents == small->small, "Small arrays should store their slots inline.");
+
+  for(i = 0; i < 20; i++) {
+    values[i] = i;
+    Tm_DArray_push(small, &values[i]);
+  }
+  mu_assert(small->contents != small->small, "Should move out once it doesn't fit.");
+
+  for(i = 0; i < 20; i++) {
+    mu_assert(*(int*)Tm_DArray_at(small, i) == i, "Should keep the inline values.");
+  }
+
+  Tm_DArray_destroy(small);
+  return NULL;
+}
+
+char *test_vec()
+{
+  Tm_Vec(int) numbers;
+  Tm_Vec_init(&numbers);
+  int i = 0;
+
+  mu_assert(Tm_Vec_count(&numbers) == 0, "Should start empty.");
+
+  for(i = 0; i < 1000; i++) {
+    mu_assert(Tm_Vec_push(&numbers, i * 3) == 0, "Push failed.");
+  }
+  mu_assert(Tm_Vec_count(&numbers) == 1000, "Wrong count.");
+  mu_assert(Tm_Vec_at(&numbers, 500) == 1500, "Wrong value.");
+  mu_assert(Tm_Vec_last(&numbers) == 2997, "Wrong last value.");
+
+  for(i = 999; i >= 0; i--) {
+    mu_assert(Tm_Vec_pop(&numbers) == i * 3, "Wrong value.");
+  }
+
+  Tm_Vec_free(&numbers);
+  mu_assert(numbers.contents == NULL, "Should be freed.");
+
   return NULL;
 }
 
@@ -115,6 +189,9 @@ char *all_tests() {
   mu_run_test(test_expand_contract);
   mu_run_test(test_push_pop);
   mu_run_test(test_destroy);
+  mu_run_test(test_shrink_hysteresis);
+  mu_run_test(test_small);
+  mu_run_test(test_vec);
 
   return NULL;
 }
@@ -0,0 +1,136 @@
+#ifndef _tests_fixture_h
+#define _tests_fixture_h
+
+#include <treadmill/gc.h>
+
+/*
+ * What the test programs share: a state whose rootset is whatever they
+ * pushed onto its registers, and test_heap, which makes a heap of their
+ * Object with their test_release and test_scan_pointers.
+ *
+ * Define FIXTURE_CHILDREN before including this for objects holding an
+ * array of children, or FIXTURE_CHILD for objects holding a single child,
+ * along with their scan and release functions. Programs with other objects
+ * bring their own. Define FIXTURE_SETUP as a function
+ * taking the heap to set up more of it, like its scan_slots.
+ */
+
+typedef struct state_s {
+  TmStateHeader gc;
+  Tm_DArray *registers;
+} State;
+
+// Counted since the last test_heap.
+static int released = 0;
+static int scans = 0;
+
+static inline Tm_DArray*
+test_rootset(TmStateHeader *state_h)
+{
+  Tm_DArray *rootset = Tm_DArray_create(sizeof(TmObjectHeader*), 10);
+  State *state = (State*)state_h;
+  for(int i=0; i<Tm_DArray_count(state->registers);i++) {
+    Tm_DArray_push(rootset, Tm_DArray_at(state->registers, i));
+  }
+
+  return rootset;
+}
+
+static inline State*
+State_new()
+{
+  State *state = calloc(1, sizeof(State));
+  state->gc.rootset = test_rootset;
+  state->registers = Tm_DArray_create(sizeof(TmObjectHeader*), 10);
+  return state;
+}
+
+static inline void
+State_destroy(State *state)
+{
+  Tm_DArray_destroy(state->registers);
+  free(state);
+}
+
+typedef void (*FixtureSetupFn)(TmHeap *heap);
+
+static inline TmHeap*
+Fixture_heap(State *state, int size, int scan_every, size_t object_size,
+  TmReleaseFn release, TmScanPointersFn scan_pointers, FixtureSetupFn setup)
+{
+  released = scans = 0;
+  TmHeap *heap = TmHeap_new((TmStateHeader*)state, size, 10, scan_every,
+    object_size, release, scan_pointers);
+  if(heap && setup) setup(heap);
+  return heap;
+}
+
+#ifndef FIXTURE_SETUP
+#define FIXTURE_SETUP NULL
+#endif
+
+// Expands where the program's Object and callbacks are known.
+#define test_heap(S, SIZE, SCAN_EVERY) \
+  Fixture_heap((S), (SIZE), (SCAN_EVERY), sizeof(Object), test_release, \
+    test_scan_pointers, FIXTURE_SETUP)
+
+#if defined(FIXTURE_CHILDREN)
+
+typedef struct object_s {
+  TmObjectHeader gc;
+  Tm_DArray *children;
+} Object;
+
+static inline void
+test_scan_pointers(TmHeap *heap, TmObjectHeader *object, TmCallbackFn callback)
+{
+  Object *self = (Object*)object;
+  scans++;
+  for(int i=0; i < Tm_DArray_count(self->children); i++) {
+    callback(heap, (TmObjectHeader*)Tm_DArray_at(self->children, i));
+  }
+}
+
+// Objects allocated without Object_new, like leaves, have no array.
+static inline void
+test_release(void *value)
+{
+  Object *self = (Object*)value;
+  released++;
+  if(self->children) Tm_DArray_destroy(self->children);
+  free(self);
+}
+
+static inline Object*
+Object_new(TmHeap *heap)
+{
+  Object *obj = (Object*)Tm_allocate(heap);
+  obj->children = Tm_DArray_create(sizeof(Object*), 10);
+  return obj;
+}
+
+#elif defined(FIXTURE_CHILD)
+
+typedef struct object_s {
+  TmObjectHeader gc;
+  struct object_s *child;
+} Object;
+
+static inline void
+test_scan_pointers(TmHeap *heap, TmObjectHeader *object, TmCallbackFn callback)
+{
+  Object *self = (Object*)object;
+  scans++;
+  if(self->child) callback(heap, (TmObjectHeader*)self->child);
+}
+
+static inline void
+test_release(void *value)
+{
+  released++;
+  free(value);
+}
+
+#endif
+
+#endif
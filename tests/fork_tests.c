@@ -0,0 +1,187 @@
+#define _DEFAULT_SOURCE
+#include "minunit.h"
+#include <unistd.h>
+#define FIXTURE_CHILD
+#define FIXTURE_SETUP use_fork
+#include "fixture.h"
+#include <treadmill/fork.h>
+#include <treadmill/weak.h>
+#include <treadmill/pin.h>
+
+static void
+use_fork(TmHeap *heap)
+{
+  heap->fork_collect = 1;
+}
+
+static Object*
+new_chain(TmHeap *heap, int length)
+{
+  Object *head = NULL;
+  for(int i=0; i < length; i++) {
+    Object *object = (Object*)Tm_allocate(heap);
+    object->child = head;
+    head = object;
+  }
+
+  return head;
+}
+
+char *test_fork_collect()
+{
+  State *state = State_new();
+  TmHeap *heap = test_heap(state, 100, 5);
+
+  Object *root = new_chain(heap, 10);
+  Tm_DArray_push(state->registers, root);
+  new_chain(heap, 20);
+
+  Tm_flip(heap);
+  mu_assert(heap->fork != NULL, "The flip should fork.");
+  mu_assert(TmHeap_ecru_size(heap) == 0, "The parent shouldn't trace.");
+
+  Tm_flip(heap);
+  mu_assert(released == 20, "Garbage found by the child should be released.");
+  mu_assert(TmHeap_black_size(heap) == 10, "Reachable objects should survive.");
+
+  TmHeap_destroy(heap);
+  State_destroy(state);
+  return NULL;
+}
+
+char *test_allocate_after_fork()
+{
+  State *state = State_new();
+  TmHeap *heap = test_heap(state, 100, 5);
+
+  new_chain(heap, 20);
+  Tm_flip(heap);
+
+  // Unreachable, but the child doesn't know about it.
+  new_chain(heap, 5);
+  Tm_flip(heap);
+  mu_assert(released == 20, "Objects allocated after the fork should be left alone.");
+
+  Tm_flip(heap);
+  mu_assert(released == 25, "The next child should find them.");
+
+  TmHeap_destroy(heap);
+  State_destroy(state);
+  return NULL;
+}
+
+char *test_poll()
+{
+  State *state = State_new();
+  TmHeap *heap = test_heap(state, 100, 5);
+
+  new_chain(heap, 20);
+  Tm_flip(heap);
+
+  // Allocations read the child's findings as they go.
+  for(int i=0; i < 2000 && heap->fork->fd >= 0; i++) {
+    Tm_DArray_push(state->registers, Tm_allocate(heap));
+    usleep(1000);
+  }
+
+  mu_assert(heap->fork->fd < 0, "The whole report should be read.");
+  mu_assert(Tm_Vec_count(&heap->fork->dead) == 20, "Dead objects should be kept.");
+  mu_assert(released == 0, "They should only be released by a flip.");
+
+  Tm_flip(heap);
+  mu_assert(released == 20, "The flip should release them.");
+
+  TmHeap_destroy(heap);
+  State_destroy(state);
+  return NULL;
+}
+
+char *test_pin_after_fork()
+{
+  State *state = State_new();
+  TmHeap *heap = test_heap(state, 100, 5);
+
+  Object *buffer = new_chain(heap, 20);
+  Tm_flip(heap);
+
+  // The child found it unreachable, but the program still uses it.
+  Tm_pin(heap, (TmObjectHeader*)buffer);
+  Tm_flip(heap);
+  mu_assert(released == 0, "Pinning should make the report stale.");
+  mu_assert(buffer->child->child != NULL, "Objects pinned after the fork should keep their children.");
+
+  Tm_unpin(heap, (TmObjectHeader*)buffer);
+  Tm_flip(heap);
+  Tm_flip(heap);
+  mu_assert(released == 20, "Unpinned objects should be released.");
+
+  TmHeap_destroy(heap);
+  State_destroy(state);
+  return NULL;
+}
+
+char *test_collect_old()
+{
+  State *state = State_new();
+  TmHeap *heap = test_heap(state, 100, 5);
+
+  Object *table = (Object*)Tm_allocate_hint(heap, TM_LONG_LIVED);
+  Tm_DArray_push(state->registers, table);
+  Tm_allocate_hint(heap, TM_LONG_LIVED);
+
+  for(int i=0; i <= TM_OLD_EVERY; i++) Tm_flip(heap);
+
+  mu_assert(released == 1, "Children should find dead old objects.");
+  mu_assert(TmHeap_immortal_size(heap) == 1, "Live old objects should be pretenured again.");
+
+  TmHeap_destroy(heap);
+  State_destroy(state);
+  return NULL;
+}
+
+char *test_weak_fallback()
+{
+  State *state = State_new();
+  TmHeap *heap = test_heap(state, 100, 5);
+
+  TmWeakRef *ref = TmWeakRef_new(heap, Tm_allocate(heap));
+  Tm_flip(heap);
+  mu_assert(heap->fork == NULL, "Heaps with weak references shouldn't fork.");
+  Tm_flip(heap);
+  mu_assert(TmWeakRef_get(heap, ref) == NULL, "The weak reference should be cleared.");
+
+  TmWeakRef_destroy(heap, ref);
+  TmHeap_destroy(heap);
+  State_destroy(state);
+  return NULL;
+}
+
+char *test_destroy_while_forked()
+{
+  State *state = State_new();
+  TmHeap *heap = test_heap(state, 100, 5);
+
+  new_chain(heap, 20);
+  Tm_flip(heap);
+  TmHeap_destroy(heap);
+  mu_assert(released == 20, "Destroying should release everything.");
+
+  State_destroy(state);
+  return NULL;
+}
+
+char *all_tests() {
+  mu_suite_start();
+
+  mu_run_test(test_fork_collect);
+  mu_run_test(test_allocate_after_fork);
+  mu_run_test(test_poll);
+  mu_run_test(test_pin_after_fork);
+  mu_run_test(test_collect_old);
+  mu_run_test(test_weak_fallback);
+  mu_run_test(test_destroy_while_forked);
+
+  return NULL;
+}
+
+RUN_TESTS(all_tests);
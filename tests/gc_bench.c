@@ -0,0 +1,156 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <treadmill/gc.h>
+
+/*
+ * Times the treadmill walks on a large heap: allocation, a flip turning
+ * every black cell ecru, a full scan of the live objects and a second flip
+ * releasing the garbage.
+ *
+ * The live objects form a binary tree over a random permutation, so after
+ * the first cycle the ring visits cells in scattered order. The second cycle
+ * drops half of the tree and measures the walks over that scattered ring.
+ *
+ *   $ tests/gc_bench [cells]
+ *
+ * Build with OPTFLAGS=-DTM_COMPACT_CELLS to measure the compact layout, or
+ * with OPTFLAGS=-DTM_NO_PREFETCH to measure without software prefetching.
+ */
+
+typedef struct state_s {
+  TmStateHeader gc;
+  TmObjectHeader *root;
+} State;
+
+typedef struct object_s {
+  TmObjectHeader gc;
+  struct object_s *left;
+  struct object_s *right;
+} Object;
+
+static Tm_DArray*
+bench_rootset(TmStateHeader *state_h)
+{
+  Tm_DArray *rootset = Tm_DArray_create(sizeof(TmObjectHeader*), 1);
+  Tm_DArray_push(rootset, ((State*)state_h)->root);
+  return rootset;
+}
+
+static void
+bench_scan_pointers(TmHeap *heap, TmObjectHeader *object, TmCallbackFn callback)
+{
+  Object *self = (Object*)object;
+  if(self->left)  callback(heap, (TmObjectHeader*)self->left);
+  if(self->right) callback(heap, (TmObjectHeader*)self->right);
+}
+
+static void
+bench_release(void *value)
+{
+  free(value);
+}
+
+static unsigned long long seed = 88172645463325252ULL;
+
+static int
+random_below(int n)
+{
+  seed ^= seed << 13;
+  seed ^= seed >> 7;
+  seed ^= seed << 17;
+  return (int)(seed % n);
+}
+
+static double
+now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int cells = argc > 1 ? atoi(argv[1]) : 10000000;
+  int live  = cells / 2;
+
+  State state = { .gc = { .rootset = bench_rootset } };
+  TmHeap *heap = TmHeap_new((TmStateHeader*)&state, cells, 1, cells + 1,
+    sizeof(Object), bench_release, bench_scan_pointers);
+
+  Object **objects = malloc(live * sizeof(Object*));
+
+  double start = now();
+  // Every other object is garbage; the live ones form a binary tree.
+  for(int i=0; i < live; i++) {
+    objects[i] = (Object*)Tm_allocate(heap);
+    Tm_allocate(heap);
+  }
+  double allocated = now();
+
+  for(int i=live - 1; i > 0; i--) {
+    int j = random_below(i + 1);
+    Object *tmp = objects[i];
+    objects[i] = objects[j];
+    objects[j] = tmp;
+  }
+
+  for(int i=0; i < live; i++) {
+    if(2 * i + 1 < live) objects[i]->left  = objects[2 * i + 1];
+    if(2 * i + 2 < live) objects[i]->right = objects[2 * i + 2];
+  }
+  Object *root = objects[0];
+  state.root = (TmObjectHeader*)root;
+  free(objects);
+
+  double t0 = now();
+  Tm_flip(heap);
+  double t1 = now();
+  Tm_scan_all(heap);
+  double t2 = now();
+  Tm_flip(heap);
+  double t3 = now();
+
+  // Drop half of the tree and collect again over the scattered ring.
+  root->right = NULL;
+  double t4 = now();
+  Tm_scan_all(heap);
+  double t5 = now();
+  Tm_flip(heap);
+  double t6 = now();
+  Tm_flip(heap);
+  double t7 = now();
+
+  printf("layout:   %s (%zu bytes per cell)\n",
+#ifdef TM_COMPACT_CELLS
+    "compact",
+#else
+    "pointers",
+#endif
+    sizeof(TmCell));
+#ifdef TM_NO_PREFETCH
+  printf("prefetch: off\n");
+#else
+  printf("prefetch: on\n");
+#endif
+  printf("cells:    %i (%i live)\n", cells, live);
+  printf("allocate: %8.3f s\n", allocated - start);
+  printf("\nsequential ring\n");
+  printf("flip:     %8.3f s (black to ecru)\n", t1 - t0);
+  printf("scan:     %8.3f s (%i objects)\n", t2 - t1, live);
+  printf("flip:     %8.3f s (release %i, black to ecru)\n", t3 - t2, cells - live);
+  printf("\nscattered ring\n");
+  printf("scan:     %8.3f s\n", t5 - t4);
+  printf("flip:     %8.3f s (release right subtree, black to ecru)\n", t6 - t5);
+  printf("flip:     %8.3f s (scan and release nothing)\n", t7 - t6);
+
+  double t8 = now();
+  TmHeap_destroy(heap);
+  double t9 = now();
+  printf("destroy:  %8.3f s (release %i)\n", t9 - t8, live / 2);
+
+  return 0;
+}
@@ -0,0 +1,134 @@
+#include "minunit.h"
+#include <vector>
+#include <treadmill/gc.hpp>
+
+static int destroyed = 0;
+
+struct Node : treadmill::object {
+  int value;
+  treadmill::gc_ptr<Node> left;
+  treadmill::gc_ptr<Node> right;
+  std::vector<treadmill::gc_ptr<Node>> children;
+
+  explicit Node(int value) : value(value) {}
+  ~Node() { destroyed++; }
+
+  static constexpr auto traced = treadmill::fields(&Node::left, &Node::right, &Node::children);
+};
+
+struct Blob : treadmill::object {
+  char bytes[16];
+  ~Blob() { destroyed++; }
+};
+
+struct Fussy : treadmill::object {
+  explicit Fussy(bool fail) { if(fail) throw std::runtime_error("nope"); }
+};
+
+static int
+cell_is_ecru(treadmill::gc_ptr<Node> node)
+{
+  return node->gc.cell->ecru;
+}
+
+char *test_make_and_root()
+{
+  destroyed = 0;
+  {
+    treadmill::heap heap(10, 10, 100, treadmill::size_for<Node, Blob, Fussy>());
+
+    treadmill::root<Node> tree(heap, treadmill::make<Node>(heap, 1));
+    tree->left = treadmill::make<Node>(heap, 2);
+    tree->right = treadmill::make<Node>(heap, 3);
+    tree->children.push_back(treadmill::make<Node>(heap, 4));
+    treadmill::make<Node>(heap, 5); // garbage
+
+    mu_assert(tree->value == 1, "Objects should be constructed in place.");
+
+    heap.flip();
+    heap.flip();
+
+    mu_assert(destroyed == 1, "Unreachable objects should be destroyed.");
+    mu_assert(tree->left->value == 2 && tree->right->value == 3, "Fields should be traced.");
+    mu_assert(tree->children[0]->value == 4, "Ranges of fields should be traced.");
+
+    heap.scan_all();
+    mu_assert(!cell_is_ecru(tree->children[0]), "Traced objects should be reached.");
+  }
+  mu_assert(destroyed == 5, "Destroying the heap should run every destructor.");
+
+  return NULL;
+}
+
+char *test_root_scope()
+{
+  destroyed = 0;
+  treadmill::heap heap(10, 10, 100, treadmill::size_for<Node, Blob, Fussy>());
+
+  treadmill::gc_ptr<Node> node = treadmill::make<Node>(heap, 1);
+  {
+    treadmill::root<Node> outer(heap, node);
+    {
+      treadmill::root<Node> inner = outer;
+      heap.flip();
+      heap.flip();
+      mu_assert(destroyed == 0, "Rooted objects should survive.");
+    }
+    heap.flip();
+    heap.flip();
+    mu_assert(destroyed == 0, "Copies of roots shouldn't unregister the original.");
+  }
+
+  heap.flip();
+  heap.flip();
+  mu_assert(destroyed == 1, "Objects should die once their roots go out of scope.");
+
+  return NULL;
+}
+
+char *test_leaf_types()
+{
+  treadmill::heap heap(10, 10, 100, treadmill::size_for<Node, Blob, Fussy>());
+
+  treadmill::gc_ptr<Blob> blob = treadmill::make<Blob>(heap);
+  treadmill::gc_ptr<Node> node = treadmill::make<Node>(heap, 1);
+
+  mu_assert(blob->gc.cell->flags & TM_LEAF, "Types without fields should be leaves.");
+  mu_assert(!(node->gc.cell->flags & TM_LEAF), "Types with fields should be scanned.");
+
+  return NULL;
+}
+
+char *test_throwing_constructor()
+{
+  treadmill::heap heap(10, 10, 100, treadmill::size_for<Node, Blob, Fussy>());
+
+  int thrown = 0;
+  try {
+    treadmill::make<Fussy>(heap, true);
+  } catch(const std::runtime_error &) {
+    thrown = 1;
+  }
+  mu_assert(thrown, "Exceptions should reach the caller.");
+
+  // The half-built object is just garbage now.
+  heap.flip();
+  heap.flip();
+
+  mu_assert(treadmill::make<Fussy>(heap, false), "The heap should keep working.");
+
+  return NULL;
+}
+
+char *all_tests() {
+  mu_suite_start();
+
+  mu_run_test(test_make_and_root);
+  mu_run_test(test_root_scope);
+  mu_run_test(test_leaf_types);
+  mu_run_test(test_throwing_constructor);
+
+  return NULL;
+}
+
+RUN_TESTS(all_tests);
@@ -35,9 +35,12 @@ test_rootset(TmStateHeader *state_h)
   return rootset;
 }
 
+static int scans = 0;
+
 void
 test_scan_pointers(TmHeap *heap, TmObjectHeader *object, TmCallbackFn callback)
 {
+  scans++;
   Object *self = (Object*)object;
   for(int i=0; i < Tm_DArray_count(self->children); i++) {
     TmObjectHeader *o = (TmObjectHeader*)Tm_DArray_at(self->children, i);
@@ -62,14 +65,20 @@ State_destroy(State *state)
 }
 
 Object*
-Object_new(TmHeap *heap)
+Object_new_flags(TmHeap *heap, int flags)
 {
-  Object *obj = (Object*)Tm_allocate(heap);
+  Object *obj = (Object*)Tm_allocate_flags(heap, flags);
   obj->health = 100;
   obj->children = Tm_DArray_create(sizeof(Object*), 10);
   return obj;
 }
 
+Object*
+Object_new(TmHeap *heap)
+{
+  return Object_new_flags(heap, 0);
+}
+
 void
 Object_print(Object *self)
 {
@@ -152,6 +161,33 @@ char *test_TmHeap_grow()
   return NULL;
 }
 
+char *test_TmHeap_grow_lazily()
+{
+  State *state = State_new();
+  TmHeap *heap = new_heap(state, 3, 10);
+
+  TmHeap_grow(heap, 5000);
+
+  TmChunk *chunk = Tm_DArray_last(heap->chunks);
+  mu_assert(chunk->linked == 0, "Growing shouldn't link any cells.");
+  mu_assert(heap->reserve == 5003, "New cells should be held in the reserve.");
+  assert_heap_size(5004);
+  assert_white_size(5004);
+
+  // Exhaust the first chunk, then take from the new one.
+  for(int i=0; i < 5; i++) Object_new(heap);
+
+  mu_assert(chunk->linked > 0, "Allocating should link reserved cells.");
+  mu_assert(chunk->linked < chunk->size, "Cells should be linked in batches.");
+  assert_heap_size(5004);
+  assert_black_size(5);
+  assert_white_size(4999);
+
+  TmHeap_destroy(heap);
+  State_destroy(state);
+  return NULL;
+}
+
 char *test_TmHeap_allocate()
 {
   State *state = State_new();
@@ -160,7 +196,7 @@ char *test_TmHeap_allocate()
   Object *obj  = Object_new(heap);
   TmCell *cell = obj->gc.cell;
 
-  mu_assert(cell == FREE->prev, "Cell should be right before the free pointer");
+  mu_assert(cell == TmCell_prev(heap, FREE), "Cell should be right before the free pointer");
   mu_assert(heap->allocs == 1, "Allocation didn't update the allocs count.");
 
   assert_heap_size(11);
@@ -251,15 +287,234 @@ char *test_TmHeap_allocate_and_grow_slowly()
   return NULL;
 }
 
+char *test_TmCell_layout()
+{
+#ifdef TM_COMPACT_CELLS
+  mu_assert(sizeof(TmCell) == 16, "Compact cells should take 16 bytes.");
+#endif
+  mu_assert(sizeof(TmCell) <= 32, "Cells should take at most 32 bytes.");
+  return NULL;
+}
+
+char *test_Tm_allocate_leaf()
+{
+  State *state = State_new();
+  TmHeap *heap = new_heap(state, 10, 10);
+
+  Object *parent = Object_new(heap);
+  Object_make_root(parent, state);
+  Object *leaf = Object_new_flags(heap, TM_LEAF);
+  Object_relate(parent, leaf);
+
+  Tm_flip(heap);
+  assert_ecru_size(1); // the leaf
+  assert_grey_size(1); // the parent
+
+  scans = 0;
+  Tm_scan_all(heap);
+
+  mu_assert(scans == 1, "Leaf objects shouldn't be scanned.");
+  mu_assert(!leaf->gc.cell->ecru, "The leaf should have been reached.");
+  assert_ecru_size(0);
+  assert_grey_size(0);
+  assert_black_size(2);
+
+  TmHeap_destroy(heap);
+  State_destroy(state);
+  return NULL;
+}
+
+char *test_Tm_allocate_immortal()
+{
+  State *state = State_new();
+  TmHeap *heap = new_heap(state, 10, 10);
+
+  Object *immortal = Object_new_flags(heap, TM_IMMORTAL);
+  Object *child = Object_new(heap);
+  Object_relate(immortal, child);
+
+  mu_assert(TmHeap_immortal_size(heap) == 1, "Wrong immortal size.");
+  assert_heap_size(10);
+  assert_black_size(1); // the child
+
+  Tm_flip(heap);
+  Tm_flip(heap);
+
+  // Nothing roots either object, but the immortal keeps its child alive.
+  mu_assert(immortal->health == 100, "The immortal should be untouched.");
+  assert_ecru_size(0);
+  assert_grey_size(1); // the child, reached from the immortal
+
+  TmHeap_destroy(heap);
+  State_destroy(state);
+  return NULL;
+}
+
+char *test_Tm_allocate_max_size()
+{
+  State *state = State_new();
+  TmHeap *heap = new_heap(state, 10, 10);
+  heap->max_size = 30;
+
+  Object *root = Object_new(heap);
+  Object_make_root(root, state);
+
+  // Plenty of garbage, but the heap never grows past its limit.
+  for(int i=0; i < 1000; i++) {
+    mu_assert(Object_new(heap) != NULL, "Garbage should be collected.");
+  }
+  mu_assert(heap->capacity <= 30, "The heap shouldn't grow past max_size.");
+  mu_assert(root->health == 100, "The root should survive.");
+
+  TmHeap_destroy(heap);
+  State_destroy(state);
+  return NULL;
+}
+
+static State *oom_state = NULL;
+static int oom_calls = 0;
+
+static int
+drop_roots(TmHeap *heap)
+{
+  oom_calls++;
+  oom_state->registers->end = 0;
+  return 1;
+}
+
+char *test_Tm_allocate_out_of_memory()
+{
+  State *state = State_new();
+  TmHeap *heap = new_heap(state, 10, 10);
+  heap->max_size = 11;
+
+  // Every object is rooted, so the heap fills up.
+  Object *obj = NULL;
+  int allocated = 0;
+  while((obj = (Object*)Tm_allocate(heap)) != NULL) {
+    obj->children = Tm_DArray_create(sizeof(Object*), 10);
+    Object_make_root(obj, state);
+    allocated++;
+    mu_assert(allocated <= 11, "Allocated more objects than cells.");
+  }
+  mu_assert(allocated > 0, "Some objects should fit.");
+
+  // With a callback that drops the roots, allocation recovers.
+  oom_state = state;
+  heap->out_of_memory = drop_roots;
+  obj = (Object*)Tm_allocate(heap);
+  mu_assert(obj != NULL, "Allocation should be retried after the callback.");
+  mu_assert(oom_calls == 1, "The callback should be called once.");
+  obj->children = Tm_DArray_create(sizeof(Object*), 10);
+
+  TmHeap_destroy(heap);
+  State_destroy(state);
+  return NULL;
+}
+
+static int released = 0;
+static int rootsets = 0;
+
+static void
+counting_release(void *value)
+{
+  released++;
+  test_release(value);
+}
+
+static Tm_DArray*
+counting_rootset(TmStateHeader *state_h)
+{
+  rootsets++;
+  return test_rootset(state_h);
+}
+
+char *test_TmHeap_destroy()
+{
+  State *state = State_new();
+  state->gc.rootset = counting_rootset;
+  TmHeap *heap = TmHeap_new((TmStateHeader*)state, 10, 10, 5,
+    sizeof(Object), counting_release, test_scan_pointers);
+
+  Object *root = Object_new(heap);
+  Object_make_root(root, state);
+  Object_relate(root, Object_new(heap));
+  Object_new(heap);
+  Object_new_flags(heap, TM_IMMORTAL);
+
+  // Leave objects of every colour behind.
+  Tm_flip(heap);
+  Object_new(heap);
+
+  mu_assert(released == 0, "Nothing should be released yet.");
+  int flips = rootsets;
+
+  TmHeap_destroy(heap);
+
+  mu_assert(released == 5, "Every object should be released.");
+  mu_assert(rootsets == flips, "Destroying the heap shouldn't collect.");
+
+  State_destroy(state);
+  return NULL;
+}
+
+static int finalized = 0;
+
+static void
+finalize(void *value)
+{
+  finalized++;
+}
+
+char *test_TmHeap_slab_bodies()
+{
+  State *state = State_new();
+  TmHeap *heap = TmHeap_new((TmStateHeader*)state, 10, 10, 5,
+    sizeof(Object), finalize, test_scan_pointers);
+  heap->slab_bodies = 1;
+
+  TmObjectHeader *root = Tm_allocate_flags(heap, TM_LEAF);
+  TmObjectHeader *garbage = Tm_allocate_flags(heap, TM_LEAF);
+  Tm_DArray_push(state->registers, root);
+
+  mu_assert((uintptr_t)root % 16 == 0, "Bodies should be aligned.");
+  mu_assert(heap->slabs != NULL, "Bodies should come from slabs.");
+
+  Tm_flip(heap);
+  Tm_flip(heap);
+  mu_assert(finalized == 1, "The release function should finalize garbage.");
+
+  TmObjectHeader *reused = Tm_allocate_flags(heap, TM_LEAF);
+  mu_assert(reused == garbage, "Released bodies should be reused.");
+  mu_assert(reused->cell != NULL && ((Object*)reused)->health == 0, "Reused bodies should be zeroed.");
+
+  for(int i=0; i < 10000; i++) Tm_allocate_flags(heap, TM_LEAF);
+  int before = finalized;
+
+  TmHeap_discard(heap);
+  mu_assert(finalized == before, "Discarding the heap shouldn't release objects one by one.");
+
+  State_destroy(state);
+  return NULL;
+}
+
 char *all_tests() {
   mu_suite_start();
 
+  mu_run_test(test_TmCell_layout);
   mu_run_test(test_TmHeap_new);
   mu_run_test(test_TmHeap_grow);
+  mu_run_test(test_TmHeap_grow_lazily);
   mu_run_test(test_TmHeap_allocate);
   mu_run_test(test_TmHeap_allocate_and_flip);
   mu_run_test(test_TmHeap_allocate_and_flip_twice);
   mu_run_test(test_TmHeap_allocate_and_grow_slowly);
+  mu_run_test(test_Tm_allocate_leaf);
+  mu_run_test(test_Tm_allocate_immortal);
+  mu_run_test(test_Tm_allocate_max_size);
+  mu_run_test(test_Tm_allocate_out_of_memory);
+  mu_run_test(test_TmHeap_destroy);
+  mu_run_test(test_TmHeap_slab_bodies);
 
   return NULL;
 }
@@ -0,0 +1,198 @@
+#define _POSIX_C_SOURCE 200809L
+#include "minunit.h"
+#define FIXTURE_SETUP use_slots
+#include "fixture.h"
+#include <treadmill/image.h>
+
+// Images copy bodies verbatim, so objects here hold nothing but values and
+// pointers to other objects.
+typedef struct object_s {
+  TmObjectHeader gc;
+  int value;
+  struct object_s *left;
+  struct object_s *right;
+} Object;
+
+void
+test_scan_pointers(TmHeap *heap, TmObjectHeader *object, TmCallbackFn callback)
+{
+  Object *self = (Object*)object;
+  if(self->left)  callback(heap, (TmObjectHeader*)self->left);
+  if(self->right) callback(heap, (TmObjectHeader*)self->right);
+}
+
+void
+test_scan_slots(TmHeap *heap, TmObjectHeader *object, TmSlotFn callback)
+{
+  Object *self = (Object*)object;
+  callback(heap, (TmObjectHeader**)&self->left);
+  callback(heap, (TmObjectHeader**)&self->right);
+}
+
+void
+test_release(void *value)
+{
+  free(value);
+}
+
+Object*
+Object_new(TmHeap *heap, int value, Object *left, Object *right)
+{
+  Object *obj = (Object*)Tm_allocate(heap);
+  obj->value = value;
+  obj->left  = left;
+  obj->right = right;
+  return obj;
+}
+
+static void
+use_slots(TmHeap *heap)
+{
+  heap->scan_slots = test_scan_slots;
+}
+
+char *test_TmHeap_save_and_load_image()
+{
+  FILE *file = tmpfile();
+  mu_assert(file != NULL, "Couldn't create a temporary file.");
+
+  // Build a small tree, with some garbage and a shared leaf.
+  State *state = State_new();
+  TmHeap *heap = test_heap(state, 10, 100);
+
+  Object *shared = (Object*)Tm_allocate_flags(heap, TM_LEAF);
+  shared->value = 3;
+  Object *left   = Object_new(heap, 1, shared, NULL);
+  Object *right  = Object_new(heap, 2, NULL, shared);
+  Object_new(heap, 42, left, right); // unreachable
+  Object *root   = Object_new(heap, 0, left, right);
+  Tm_DArray_push(state->registers, root);
+
+  mu_assert(TmHeap_save_image(heap, fileno(file)) == 0, "Saving failed.");
+  TmHeap_destroy(heap);
+  State_destroy(state);
+
+  // Map it back into a fresh heap.
+  state = State_new();
+  heap = test_heap(state, 10, 100);
+
+  Tm_DArray *roots = TmHeap_load_image(heap, fileno(file));
+  fclose(file);
+
+  mu_assert(roots != NULL, "Loading failed.");
+  mu_assert(Tm_DArray_count(roots) == 1, "Wrong number of roots.");
+  mu_assert(TmHeap_immortal_size(heap) == 4, "Garbage shouldn't be saved.");
+
+  root = Tm_DArray_at(roots, 0);
+  Tm_DArray_destroy(roots);
+
+  mu_assert(root->value == 0, "Wrong root.");
+  mu_assert(root->left->value == 1 && root->right->value == 2, "Wrong children.");
+  mu_assert(root->left->left == root->right->right, "Shared objects should stay shared.");
+  mu_assert(root->left->left->value == 3, "Wrong grandchild.");
+  mu_assert(root->gc.cell->flags & TM_IMMORTAL, "Loaded objects should be immortal.");
+  mu_assert(root->left->left->gc.cell->flags & TM_LEAF, "Flags should be kept.");
+
+  // Image objects can point at new objects, which they keep alive.
+  Object *fresh = Object_new(heap, 7, NULL, NULL);
+  root->right->left = fresh;
+
+  Tm_flip(heap);
+  Tm_flip(heap);
+  Tm_flip(heap);
+  mu_assert(fresh->value == 7, "Objects reachable from the image should survive.");
+  mu_assert(!fresh->gc.cell->ecru, "Objects reachable from the image should be live.");
+
+  TmHeap_destroy(heap);
+  State_destroy(state);
+  return NULL;
+}
+
+char *test_TmHeap_load_image_rejects_garbage()
+{
+  FILE *file = tmpfile();
+  mu_assert(file != NULL, "Couldn't create a temporary file.");
+  fputs("definitely not a heap image, but long enough to have a header", file);
+  fflush(file);
+
+  State *state = State_new();
+  TmHeap *heap = test_heap(state, 10, 100);
+
+  mu_assert(TmHeap_load_image(heap, fileno(file)) == NULL, "Garbage should be rejected.");
+  mu_assert(TmHeap_immortal_size(heap) == 0, "Nothing should be loaded.");
+
+  fclose(file);
+  TmHeap_destroy(heap);
+  State_destroy(state);
+  return NULL;
+}
+
+// Writes an image header, one root and `bodies` bodies after a page, whose
+// left child is at offset `left`.
+static FILE*
+forged_image(uint64_t count, uint64_t roots, uint64_t root, int bodies, uintptr_t left)
+{
+  FILE *file = tmpfile();
+  if(file == NULL) return NULL;
+
+  uint32_t magic = TM_IMAGE_MAGIC, version = TM_IMAGE_VERSION;
+  uint64_t size = sizeof(Object), data = 4096;
+  fwrite(&magic, sizeof(magic), 1, file);
+  fwrite(&version, sizeof(version), 1, file);
+  fwrite(&size, sizeof(size), 1, file);
+  fwrite(&count, sizeof(count), 1, file);
+  fwrite(&roots, sizeof(roots), 1, file);
+  fwrite(&data, sizeof(data), 1, file);
+  fwrite(&root, sizeof(root), 1, file);
+
+  fseek(file, data, SEEK_SET);
+  Object body = { { NULL }, 0, (Object*)left, NULL };
+  for(int i=0; i < bodies; i++) fwrite(&body, sizeof(body), 1, file);
+  fflush(file);
+  return file;
+}
+
+char *test_TmHeap_load_image_checks_header()
+{
+  State *state = State_new();
+  TmHeap *heap = test_heap(state, 10, 100);
+
+  FILE *files[] = {
+    forged_image(1, 1, 4096 + 1, 1, 0),                        // root inside a body
+    forged_image(1, 1, 64, 1, 0),                              // root in the header
+    forged_image(1, 1, 4096 + sizeof(Object), 1, 0),           // root past the bodies
+    forged_image(UINT64_MAX / sizeof(Object) + 2, 1, 0, 1, 0), // count wrapping around
+    forged_image(1, UINT64_MAX / 8 + 1, 0, 1, 0),              // roots wrapping around
+    forged_image(1, 1, 4096, 1, 4096 + 1),                     // pointer inside a body
+  };
+
+  for(size_t i=0; i < sizeof(files) / sizeof(files[0]); i++) {
+    mu_assert(files[i] != NULL, "Couldn't create a temporary file.");
+    mu_assert(TmHeap_load_image(heap, fileno(files[i])) == NULL, "Forged images should be rejected.");
+    fclose(files[i]);
+  }
+  mu_assert(TmHeap_immortal_size(heap) == 0, "Nothing should be loaded.");
+
+  FILE *file = forged_image(1, 1, 4096, 1, 0);
+  Tm_DArray *roots = TmHeap_load_image(heap, fileno(file));
+  mu_assert(roots != NULL, "A well-formed image should load.");
+  mu_assert(TmHeap_immortal_size(heap) == 1, "Its object should be loaded.");
+  Tm_DArray_destroy(roots);
+  fclose(file);
+
+  TmHeap_destroy(heap);
+  State_destroy(state);
+  return NULL;
+}
+
+char *all_tests() {
+  mu_suite_start();
+
+  mu_run_test(test_TmHeap_save_and_load_image);
+  mu_run_test(test_TmHeap_load_image_rejects_garbage);
+  mu_run_test(test_TmHeap_load_image_checks_header);
+
+  return NULL;
+}
+
+RUN_TESTS(all_tests);
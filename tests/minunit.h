@@ -7,7 +7,7 @@
 #include <stdlib.h>
 
 #define mu_suite_start() char *message = NULL
-#define mu_assert(test, message) if (!(test)) { log_err(message); return message; }
+#define mu_assert(test, message) if (!(test)) { log_err(message); return (char *)(message); }
 #define mu_run_test(test) debug("\n-----%s", " " #test); \
   message = test(); tests_run++; if (message) return message;
 
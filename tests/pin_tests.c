@@ -0,0 +1,116 @@
+#include "minunit.h"
+#define FIXTURE_CHILD
+#include "fixture.h"
+#include <treadmill/pin.h>
+
+char *test_pin_unreachable()
+{
+  State *state = State_new();
+  TmHeap *heap = test_heap(state, 10, 5);
+
+  Object *buffer = (Object*)Tm_allocate(heap);
+  buffer->child = (Object*)Tm_allocate(heap);
+
+  mu_assert(Tm_pin(heap, (TmObjectHeader*)buffer) == 0, "Couldn't pin.");
+  mu_assert(TmHeap_pinned_size(heap) == 1, "Pinned objects should be counted.");
+
+  Tm_flip(heap);
+  Tm_flip(heap);
+  Tm_flip(heap);
+  mu_assert(released == 0, "Pinned objects and their children should survive.");
+
+  mu_assert(Tm_unpin(heap, (TmObjectHeader*)buffer) == 0, "Couldn't unpin.");
+  mu_assert(TmHeap_pinned_size(heap) == 0, "Unpinned objects shouldn't be counted.");
+
+  Tm_flip(heap);
+  Tm_flip(heap);
+  mu_assert(released == 2, "Unpinned objects should be collected.");
+
+  TmHeap_destroy(heap);
+  State_destroy(state);
+  return NULL;
+}
+
+char *test_pin_nested()
+{
+  State *state = State_new();
+  TmHeap *heap = test_heap(state, 10, 5);
+
+  Object *buffer = (Object*)Tm_allocate(heap);
+  Tm_pin(heap, (TmObjectHeader*)buffer);
+  Tm_pin(heap, (TmObjectHeader*)buffer);
+  mu_assert(Tm_pins(heap, (TmObjectHeader*)buffer) == 2, "Pins should nest.");
+  mu_assert(TmHeap_pinned_size(heap) == 1, "Objects should be counted once.");
+
+  mu_assert(Tm_unpin(heap, (TmObjectHeader*)buffer) == 1, "One pin should be left.");
+  Tm_flip(heap);
+  Tm_flip(heap);
+  mu_assert(released == 0, "The object should still be pinned.");
+
+  mu_assert(Tm_unpin(heap, (TmObjectHeader*)buffer) == 0, "No pin should be left.");
+  mu_assert(Tm_unpin(heap, (TmObjectHeader*)buffer) == -1, "The object isn't pinned anymore.");
+
+  TmHeap_destroy(heap);
+  State_destroy(state);
+  return NULL;
+}
+
+char *test_pin_ecru()
+{
+  State *state = State_new();
+  TmHeap *heap = test_heap(state, 10, 5);
+
+  Object *buffer = (Object*)Tm_allocate(heap);
+  Tm_flip(heap);
+  mu_assert(buffer->gc.cell->ecru, "The object should be ecru.");
+
+  Tm_pin(heap, (TmObjectHeader*)buffer);
+  mu_assert(!buffer->gc.cell->ecru, "Pinning should shade the object.");
+
+  Tm_flip(heap);
+  mu_assert(released == 0, "The object shouldn't be released.");
+
+  Tm_unpin(heap, (TmObjectHeader*)buffer);
+  TmHeap_destroy(heap);
+  State_destroy(state);
+  return NULL;
+}
+
+char *test_pin_many()
+{
+  State *state = State_new();
+  TmHeap *heap = test_heap(state, 10, 5);
+  Object *buffers[100];
+
+  for(int i=0; i < 100; i++) {
+    buffers[i] = (Object*)Tm_allocate(heap);
+    Tm_pin(heap, (TmObjectHeader*)buffers[i]);
+  }
+  mu_assert(TmHeap_pinned_size(heap) == 100, "Wrong number of pinned objects.");
+
+  Tm_flip(heap);
+  Tm_flip(heap);
+  mu_assert(released == 0, "Pinned objects shouldn't be released.");
+
+  for(int i=0; i < 100; i++) Tm_unpin(heap, (TmObjectHeader*)buffers[i]);
+  Tm_flip(heap);
+  Tm_flip(heap);
+  mu_assert(released == 100, "Unpinned objects should be released.");
+
+  TmHeap_destroy(heap);
+  State_destroy(state);
+  return NULL;
+}
+
+char *all_tests() {
+  mu_suite_start();
+
+  mu_run_test(test_pin_unreachable);
+  mu_run_test(test_pin_nested);
+  mu_run_test(test_pin_ecru);
+  mu_run_test(test_pin_many);
+
+  return NULL;
+}
+
+RUN_TESTS(all_tests);
@@ -0,0 +1,201 @@
+#include "minunit.h"
+#include "fixture.h"
+#include <treadmill/pool.h>
+
+#define assert_heap_size(A) mu_assert(TmHeap_size(heap) == (A), "Wrong heap size. Expected " #A)
+
+typedef struct object_s {
+  TmObjectHeader gc;
+  int health;
+} Object;
+
+void
+test_scan_pointers(TmHeap *heap, TmObjectHeader *object, TmCallbackFn callback)
+{
+}
+
+void
+test_release(void *value)
+{
+  free(value);
+}
+
+char *test_TmPool_take_and_give()
+{
+  TmPool_trim();
+  size_t mapped = TmPool_mapped();
+
+  size_t bytes = 4096;
+  void *memory = TmPool_take(&bytes, 0);
+  mu_assert(memory != NULL, "Failed to map memory.");
+  mu_assert(bytes == 4096, "New mappings should be as large as asked.");
+  mu_assert(TmPool_mapped() == mapped + 4096, "Mappings should be counted.");
+  memset(memory, 0xff, 4096);
+
+  TmPool_give(memory, bytes, 0);
+  mu_assert(TmPool_idle() == 4096, "Given memory should be kept idle.");
+
+  unsigned char *again = TmPool_take(&bytes, 0);
+  mu_assert(again == memory, "Idle memory should be reused.");
+  mu_assert(again[0] == 0xff && again[4095] == 0xff, "Reused memory shouldn't be touched.");
+  mu_assert(TmPool_idle() == 0, "Reused memory isn't idle.");
+
+  TmPool_give(again, bytes, 0);
+  TmPool_trim();
+  mu_assert(TmPool_idle() == 0, "Trimming should unmap idle memory.");
+  mu_assert(TmPool_mapped() == mapped, "Trimmed memory shouldn't be counted.");
+
+  return NULL;
+}
+
+char *test_TmPool_best_fit()
+{
+  TmPool_trim();
+
+  size_t small = 4 * 4096, large = 6 * 4096, huge = 16 * 4096;
+  void *first  = TmPool_take(&large, 0);
+  void *second = TmPool_take(&huge, 0);
+  TmPool_give(first, large, 0);
+  TmPool_give(second, huge, 0);
+
+  size_t bytes = small;
+  void *memory = TmPool_take(&bytes, 0);
+  mu_assert(memory == first, "The smallest idle mapping that fits should be reused.");
+  mu_assert(bytes == large, "The size to give back should be the mapping's.");
+  TmPool_give(memory, bytes, 0);
+
+  bytes = 4096;
+  memory = TmPool_take(&bytes, 0);
+  mu_assert(memory != first && memory != second, "Much larger mappings shouldn't be reused.");
+  TmPool_give(memory, bytes, 0);
+
+  TmPool_trim();
+  return NULL;
+}
+
+char *test_TmPool_budget()
+{
+  TmPool_trim();
+  size_t mapped = TmPool_mapped();
+
+  TmPool_set_budget(mapped + 8192);
+  size_t bytes = 8192, more = 4096;
+  void *first = TmPool_take(&bytes, 0);
+  mu_assert(first != NULL, "Mapping within budget should work.");
+  mu_assert(TmPool_take(&more, 0) == NULL, "Mapping over budget should fail.");
+
+  // Idle memory is evicted to make room, or reused.
+  TmPool_give(first, bytes, 0);
+  void *second = TmPool_take(&more, 0);
+  mu_assert(second != NULL, "Idle memory should make room within budget.");
+  TmPool_give(second, more, 0);
+
+  TmPool_set_budget(0);
+  TmPool_trim();
+  return NULL;
+}
+
+char *test_TmHeap_new_fails()
+{
+  State *state = State_new();
+
+#ifdef TM_COMPACT_CELLS
+  // Compact heaps carve their chunks out of their own arena instead.
+  TmHeap *heap = test_heap(state, TM_MAX_CELLS, 100);
+#else
+  TmPool_trim();
+  TmPool_set_budget(TmPool_mapped() + 4096);
+  TmHeap *heap = test_heap(state, 10000, 100);
+  TmPool_set_budget(0);
+#endif
+
+  mu_assert(heap == NULL, "Heaps without room for their first cell shouldn't be created.");
+
+  State_destroy(state);
+  return NULL;
+}
+
+char *test_TmHeap_reuses_chunks()
+{
+  TmPool_trim();
+
+  State *state = State_new();
+  TmHeap *heap = test_heap(state, 1000, 100);
+  TmHeap_destroy(heap);
+
+#ifndef TM_COMPACT_CELLS
+  // Compact heaps carve their chunks out of their own arena instead.
+  mu_assert(TmPool_idle() > 0, "Destroyed heaps should give chunks back.");
+#endif
+  size_t mapped = TmPool_mapped();
+
+  heap = test_heap(state, 1000, 100);
+  mu_assert(TmPool_mapped() == mapped, "New heaps should reuse idle chunks.");
+  assert_heap_size(1001);
+  TmHeap_destroy(heap);
+
+  heap = test_heap(state, 700, 100);
+  mu_assert(TmPool_mapped() == mapped, "Smaller heaps should reuse idle chunks too.");
+  assert_heap_size(701);
+
+  TmHeap_destroy(heap);
+  State_destroy(state);
+  TmPool_trim();
+  return NULL;
+}
+
+char *test_TmHeap_shrink()
+{
+  State *state = State_new();
+  TmHeap *heap = test_heap(state, 10, 100);
+
+  Object *root = (Object*)Tm_allocate(heap);
+  Tm_DArray_push(state->registers, root);
+
+  TmHeap_grow(heap, 5000);
+  TmHeap_grow(heap, 5000);
+  assert_heap_size(10011);
+
+  // Use a few cells of the first new chunk.
+  for(int i=0; i < 20; i++) Tm_allocate(heap);
+  Tm_flip(heap);
+  Tm_flip(heap);
+
+#ifdef TM_COMPACT_CELLS
+  mu_assert(TmHeap_shrink(heap) == 0, "Compact heaps don't shrink.");
+#else
+  int before = TmHeap_size(heap);
+  int released = TmHeap_shrink(heap);
+
+  mu_assert(released > 0, "White chunks should be released.");
+  mu_assert(TmHeap_size(heap) == before - released, "Released cells shouldn't be counted.");
+
+  // The heap keeps working after shrinking.
+  for(int i=0; i < 100; i++) {
+    Object *obj = (Object*)Tm_allocate(heap);
+    obj->health = i;
+  }
+  Tm_flip(heap);
+  mu_assert(root->health == 0, "The root should be untouched.");
+#endif
+
+  TmHeap_destroy(heap);
+  State_destroy(state);
+  TmPool_trim();
+  return NULL;
+}
+
+char *all_tests() {
+  mu_suite_start();
+
+  mu_run_test(test_TmPool_take_and_give);
+  mu_run_test(test_TmPool_best_fit);
+  mu_run_test(test_TmPool_budget);
+  mu_run_test(test_TmHeap_new_fails);
+  mu_run_test(test_TmHeap_reuses_chunks);
+  mu_run_test(test_TmHeap_shrink);
+
+  return NULL;
+}
+
+RUN_TESTS(all_tests);
@@ -0,0 +1,200 @@
+#include "minunit.h"
+#include <stddef.h>
+#define FIXTURE_SETUP use_slots
+#include "fixture.h"
+#include <treadmill/region.h>
+#include <treadmill/weak.h>
+
+typedef struct object_s {
+  TmObjectHeader gc;
+  int value;
+  struct object_s *left;
+  struct object_s *right;
+} Object;
+
+void
+test_scan_pointers(TmHeap *heap, TmObjectHeader *object, TmCallbackFn callback)
+{
+  Object *self = (Object*)object;
+  if(self->left)  callback(heap, (TmObjectHeader*)self->left);
+  if(self->right) callback(heap, (TmObjectHeader*)self->right);
+}
+
+void
+test_scan_slots(TmHeap *heap, TmObjectHeader *object, TmSlotFn callback)
+{
+  Object *self = (Object*)object;
+  callback(heap, (TmObjectHeader**)&self->left);
+  callback(heap, (TmObjectHeader**)&self->right);
+}
+
+void
+test_release(void *value)
+{
+  released++;
+  free(value);
+}
+
+static void
+use_slots(TmHeap *heap)
+{
+  heap->scan_slots = test_scan_slots;
+}
+
+static Object*
+Object_new(TmHeap *heap, int value)
+{
+  Object *obj = (Object*)Tm_allocate(heap);
+  obj->value = value;
+  return obj;
+}
+
+static void
+Object_set_left(TmHeap *heap, Object *self, Object *left)
+{
+  self->left = left;
+  Tm_write_barrier(heap, (TmObjectHeader*)self, offsetof(Object, left), (TmObjectHeader*)left);
+}
+
+static int
+in_heap(Object *obj)
+{
+  return !(obj->gc.cell->flags & TM_REGION) && obj->gc.cell->value == obj;
+}
+
+char *test_region_allocate()
+{
+  State *state = State_new();
+  TmHeap *heap = test_heap(state, 10, 5);
+  double black = TmHeap_black_size(heap);
+
+  mu_assert(Tm_region_begin(heap) == 0, "Couldn't begin a region.");
+  mu_assert(Tm_region_begin(heap) == -1, "Regions shouldn't nest.");
+
+  Object *obj = Object_new(heap, 1);
+  Object *leaf = (Object*)Tm_allocate_flags(heap, TM_LEAF);
+  Object *immortal = (Object*)Tm_allocate_flags(heap, TM_IMMORTAL);
+
+  mu_assert(obj->gc.cell->flags & TM_REGION, "Objects should be allocated in the region.");
+  mu_assert(leaf->gc.cell->flags & TM_LEAF, "Region leaves should stay leaves.");
+  mu_assert(immortal->gc.cell->flags & TM_IMMORTAL, "Immortals should go to the heap.");
+  mu_assert(TmHeap_black_size(heap) == black, "Region objects shouldn't take cells.");
+  mu_assert((uintptr_t)obj % 16 == 0, "Region objects should be aligned.");
+  mu_assert(TmWeakRef_new(heap, (TmObjectHeader*)obj) == NULL, "Region objects can't be referenced weakly.");
+  TmWeakTable *table = TmWeakTable_new(heap, 8);
+  mu_assert(TmWeakTable_put(table, (TmObjectHeader*)obj, obj) == -1, "Region objects can't be weak keys.");
+  TmWeakTable_destroy(heap, table);
+
+  mu_assert(Tm_region_end(heap, NULL) == 0, "Nothing should survive.");
+  mu_assert(heap->region == NULL, "The region should be gone.");
+  mu_assert(released == 0, "Region objects shouldn't be released one by one.");
+
+  TmHeap_destroy(heap);
+  State_destroy(state);
+  return NULL;
+}
+
+char *test_region_escaping()
+{
+  State *state = State_new();
+  TmHeap *heap = test_heap(state, 10, 5);
+  Tm_DArray *escaping = Tm_DArray_create(sizeof(Object*), 1);
+
+  Tm_region_begin(heap);
+
+  Object *a = Object_new(heap, 1);
+  Object *b = Object_new(heap, 2);
+  Object *c = Object_new(heap, 3);
+  Object_set_left(heap, a, b);
+  Object_set_left(heap, b, c);
+  c->right = a; // cycles are fine
+  Object_new(heap, 4); // garbage
+
+  Tm_DArray_push(escaping, a);
+  double black = TmHeap_black_size(heap);
+  mu_assert(Tm_region_end(heap, escaping) == 3, "Reachable objects should survive.");
+
+  Object *copy = Tm_DArray_at(escaping, 0);
+  mu_assert(copy != a && in_heap(copy), "Escaping objects should be replaced by their copies.");
+  mu_assert(copy->value == 1 && copy->left->value == 2 && copy->left->left->value == 3,
+    "Copies should keep their contents.");
+  mu_assert(in_heap(copy->left) && in_heap(copy->left->left), "Pointers should be updated.");
+  mu_assert(copy->left->left->right == copy, "Cycles should be preserved.");
+  mu_assert(TmHeap_black_size(heap) == black + 3, "Survivors should be black.");
+
+  Tm_DArray_push(state->registers, copy);
+  Tm_flip(heap);
+  Tm_flip(heap);
+  mu_assert(released == 0, "Survivors should be collected like any other object.");
+
+  Tm_DArray_destroy(escaping);
+  TmHeap_destroy(heap);
+  State_destroy(state);
+  return NULL;
+}
+
+char *test_region_remembered()
+{
+  State *state = State_new();
+  TmHeap *heap = test_heap(state, 10, 5);
+
+  Object *parent = Object_new(heap, 1);
+  Tm_DArray_push(state->registers, parent);
+
+  Tm_region_begin(heap);
+  Object_set_left(heap, parent, Object_new(heap, 2));
+  Object_new(heap, 3); // garbage
+
+  mu_assert(Tm_region_end(heap, NULL) == 1, "Objects stored in the heap should survive.");
+  mu_assert(in_heap(parent->left) && parent->left->value == 2, "Heap pointers should be updated.");
+
+  TmHeap_destroy(heap);
+  State_destroy(state);
+  return NULL;
+}
+
+char *test_region_keeps_heap_objects()
+{
+  State *state = State_new();
+  TmHeap *heap = test_heap(state, 10, 5);
+  Tm_DArray *escaping = Tm_DArray_create(sizeof(Object*), 1);
+
+  Object *old = Object_new(heap, 1);
+
+  Tm_region_begin(heap);
+  Object *young = Object_new(heap, 2);
+  Object_set_left(heap, young, old);
+
+  // Only the region points at the old object now.
+  Tm_flip(heap);
+  Tm_flip(heap);
+  mu_assert(released == 0, "Region objects should keep heap objects alive.");
+
+  Tm_DArray_push(escaping, young);
+  Tm_region_end(heap, escaping);
+  Object *copy = Tm_DArray_at(escaping, 0);
+  mu_assert(copy->left == old, "Pointers to the heap should be kept.");
+
+  Tm_DArray_push(state->registers, copy);
+  Tm_flip(heap);
+  Tm_flip(heap);
+  mu_assert(released == 0, "Copies should keep heap objects alive.");
+
+  Tm_DArray_destroy(escaping);
+  TmHeap_destroy(heap);
+  State_destroy(state);
+  return NULL;
+}
+
+char *all_tests() {
+  mu_suite_start();
+
+  mu_run_test(test_region_allocate);
+  mu_run_test(test_region_escaping);
+  mu_run_test(test_region_remembered);
+  mu_run_test(test_region_keeps_heap_objects);
+
+  return NULL;
+}
+
+RUN_TESTS(all_tests);
@@ -0,0 +1,147 @@
+#include "minunit.h"
+#define FIXTURE_CHILD
+#include "fixture.h"
+#include <treadmill/site.h>
+
+static void
+Object_set_child(TmHeap *heap, Object *self, Object *child)
+{
+  self->child = child;
+  Tm_write_barrier(heap, (TmObjectHeader*)self, 0, (TmObjectHeader*)child);
+}
+
+char *test_allocate_hint()
+{
+  State *state = State_new();
+  TmHeap *heap = test_heap(state, 10, 5);
+
+  Object *table = (Object*)Tm_allocate_hint(heap, TM_LONG_LIVED);
+  Object *code  = (Object*)Tm_allocate_hint(heap, TM_LONG_LIVED | TM_LEAF);
+  mu_assert(table->gc.cell->flags & TM_IMMORTAL, "Long-lived objects should be pretenured.");
+  mu_assert(code->gc.cell->flags & TM_LEAF, "Flags should be kept.");
+  mu_assert(TmHeap_immortal_size(heap) == 2, "Wrong immortal size.");
+
+  Object_set_child(heap, table, (Object*)Tm_allocate_hint(heap, TM_LONG_LIVED));
+  Tm_flip(heap);
+  Tm_flip(heap);
+  mu_assert(scans == 0, "Pretenured objects pointing to immortals shouldn't be scanned.");
+
+  TmHeap_destroy(heap);
+  State_destroy(state);
+  return NULL;
+}
+
+char *test_remembered()
+{
+  State *state = State_new();
+  TmHeap *heap = test_heap(state, 10, 5);
+
+  Object *table = (Object*)Tm_allocate_hint(heap, TM_LONG_LIVED);
+  Object *child = (Object*)Tm_allocate(heap);
+  Tm_flip(heap);
+  mu_assert(child->gc.cell->ecru, "The child should be ecru.");
+
+  Object_set_child(heap, table, child);
+  mu_assert(!child->gc.cell->ecru, "Storing into pretenured objects should shade.");
+  mu_assert(table->gc.cell->flags & TM_REMEMBERED, "The object should be remembered.");
+
+  Tm_flip(heap);
+  Tm_flip(heap);
+  Tm_flip(heap);
+  mu_assert(released == 0, "Pretenured objects should keep their children alive.");
+  mu_assert(Tm_Vec_count(&heap->remembered) == 1, "Objects should be remembered once.");
+
+  TmHeap_destroy(heap);
+  State_destroy(state);
+  return NULL;
+}
+
+char *test_collect_old()
+{
+  State *state = State_new();
+  TmHeap *heap = test_heap(state, 10, 5);
+
+  Object *table = (Object*)Tm_allocate_hint(heap, TM_LONG_LIVED);
+  Tm_DArray_push(state->registers, table);
+  Object_set_child(heap, table, (Object*)Tm_allocate_hint(heap, TM_LONG_LIVED));
+  Object_set_child(heap, table->child, (Object*)Tm_allocate(heap));
+  Tm_allocate_hint(heap, TM_LONG_LIVED);
+
+  for(int i=0; i <= TM_OLD_EVERY; i++) Tm_flip(heap);
+
+  mu_assert(released == 1, "Dead old objects should be released eventually.");
+  mu_assert(TmHeap_immortal_size(heap) == 2, "Live old objects should be pretenured again.");
+  mu_assert(table->child->gc.cell->flags & TM_IMMORTAL, "Old objects reachable from old ones should survive.");
+  mu_assert(Tm_Vec_count(&heap->remembered) == 1, "Surviving objects should still be remembered.");
+
+  Tm_flip(heap);
+  Tm_flip(heap);
+  mu_assert(released == 1, "Remembered objects should keep their children alive.");
+
+  TmHeap_destroy(heap);
+  State_destroy(state);
+  return NULL;
+}
+
+char *test_forget_dead_remembered()
+{
+  State *state = State_new();
+  TmHeap *heap = test_heap(state, 10, 5);
+
+  Object *table = (Object*)Tm_allocate_hint(heap, TM_LONG_LIVED);
+  Object_set_child(heap, table, (Object*)Tm_allocate(heap));
+  mu_assert(Tm_Vec_count(&heap->remembered) == 1, "The object should be remembered.");
+
+  for(int i=0; i <= TM_OLD_EVERY; i++) Tm_flip(heap);
+
+  mu_assert(released == 1, "Unreachable old objects should be released.");
+  mu_assert(Tm_Vec_count(&heap->remembered) == 0, "Released objects should be forgotten.");
+
+  Tm_flip(heap);
+  mu_assert(released == 2, "Their children should follow.");
+
+  TmHeap_destroy(heap);
+  State_destroy(state);
+  return NULL;
+}
+
+char *test_allocate_site()
+{
+  State *state = State_new();
+  TmHeap *heap = test_heap(state, 10, 5);
+  int samples = TM_SITE_SAMPLES * TM_SITE_SAMPLE_EVERY;
+
+  for(int i=0; i < samples; i++) {
+    Tm_DArray_push(state->registers, Tm_allocate_site(heap, 1, 0));
+    Tm_allocate_site(heap, 2, 0);
+  }
+
+  for(int i=0; i < TM_SITE_AGE; i++) Tm_flip(heap);
+
+  mu_assert(TmHeap_site(heap, 1)->state == TM_SITE_PRETENURED, "Surviving sites should be pretenured.");
+  mu_assert(TmHeap_site(heap, 2)->state == TM_SITE_YOUNG, "Dying sites shouldn't be pretenured.");
+  mu_assert(TmHeap_site(heap, 0)->state == TM_SITE_UNDECIDED, "Unused sites should be undecided.");
+
+  Object *old = (Object*)Tm_allocate_site(heap, 1, 0);
+  Object *young = (Object*)Tm_allocate_site(heap, 2, 0);
+  mu_assert(old->gc.cell->flags & TM_OLD, "Pretenured sites should allocate old objects.");
+  mu_assert(!(young->gc.cell->flags & TM_IMMORTAL), "Young sites should allocate as usual.");
+
+  TmHeap_destroy(heap);
+  State_destroy(state);
+  return NULL;
+}
+
+char *all_tests() {
+  mu_suite_start();
+
+  mu_run_test(test_allocate_hint);
+  mu_run_test(test_remembered);
+  mu_run_test(test_collect_old);
+  mu_run_test(test_forget_dead_remembered);
+  mu_run_test(test_allocate_site);
+
+  return NULL;
+}
+
+RUN_TESTS(all_tests);
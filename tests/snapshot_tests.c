@@ -0,0 +1,86 @@
+#define _POSIX_C_SOURCE 200809L
+#include "minunit.h"
+#include <stdint.h>
+#define FIXTURE_CHILDREN
+#include "fixture.h"
+#include <treadmill/snapshot.h>
+
+typedef struct counts_s {
+  int roots;
+  int nodes;
+  int edges;
+  int black;
+  int ended;
+} Counts;
+
+static Counts
+read_counts(FILE *file)
+{
+  Counts counts = { 0 };
+  uint32_t magic = 0, version = 0;
+  uint64_t size = 0, id = 0;
+  unsigned char tag, colour;
+
+  rewind(file);
+  if(fread(&magic, sizeof(magic), 1, file) != 1) return counts;
+  if(fread(&version, sizeof(version), 1, file) != 1) return counts;
+  if(fread(&size, sizeof(size), 1, file) != 1) return counts;
+  if(magic != TM_SNAPSHOT_MAGIC || size != sizeof(Object)) return counts;
+
+  while(fread(&tag, sizeof(tag), 1, file) == 1) {
+    if(tag == TM_SNAPSHOT_END) {
+      counts.ended = 1;
+      break;
+    }
+    if(fread(&id, sizeof(id), 1, file) != 1) break;
+    if(tag == TM_SNAPSHOT_ROOT) counts.roots++;
+    if(tag == TM_SNAPSHOT_EDGE) counts.edges++;
+    if(tag == TM_SNAPSHOT_NODE) {
+      counts.nodes++;
+      if(fread(&colour, sizeof(colour), 1, file) != 1) break;
+      if(fread(&size, sizeof(size), 1, file) != 1) break;
+      if(colour == TM_BLACK) counts.black++;
+    }
+  }
+
+  return counts;
+}
+
+char *test_TmHeap_snapshot()
+{
+  State *state = State_new();
+  TmHeap *heap = test_heap(state, 10, 5);
+
+  Object *parent = Object_new(heap);
+  Tm_DArray_push(state->registers, parent);
+  Tm_DArray_push(parent->children, Object_new(heap));
+  Tm_DArray_push(parent->children, Object_new(heap));
+  Object_new(heap); // unreachable
+
+  FILE *file = tmpfile();
+  mu_assert(file != NULL, "Couldn't create a temporary file.");
+  mu_assert(TmHeap_snapshot(heap, fileno(file)) == 0, "Snapshot failed.");
+
+  Counts counts = read_counts(file);
+  fclose(file);
+
+  mu_assert(counts.ended, "Snapshot should be terminated.");
+  mu_assert(counts.roots == 1, "Wrong number of roots.");
+  mu_assert(counts.nodes == 4, "Wrong number of nodes.");
+  mu_assert(counts.edges == 2, "Wrong number of edges.");
+  mu_assert(counts.black == 4, "Newly allocated objects should be black.");
+
+  TmHeap_destroy(heap);
+  State_destroy(state);
+  return NULL;
+}
+
+char *all_tests() {
+  mu_suite_start();
+
+  mu_run_test(test_TmHeap_snapshot);
+
+  return NULL;
+}
+
+RUN_TESTS(all_tests);
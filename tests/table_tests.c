@@ -0,0 +1,68 @@
+#include "minunit.h"
+#include <stdint.h>
+#include <treadmill/table.h>
+
+#define KEY(I) ((void*)(uintptr_t)(((I) + 1) * 16))
+
+char *test_insert_and_find()
+{
+  TmTable table = { 0 };
+
+  mu_assert(TmTable_find(&table, KEY(0)) == -1, "An empty table should find nothing.");
+
+  for(int i=0; i < 100; i++) {
+    int slot = TmTable_insert(&table, KEY(i));
+    mu_assert(slot >= 0, "Failed to insert.");
+    table.values[slot] = KEY(i * 2);
+  }
+
+  mu_assert(table.count == 100, "Wrong number of entries.");
+  mu_assert(table.count * 2 <= table.capacity, "Half of the slots should be empty.");
+  for(int i=0; i < 100; i++) {
+    mu_assert(TmTable_get(&table, KEY(i)) == KEY(i * 2), "Wrong value.");
+  }
+
+  int slot = TmTable_find(&table, KEY(7));
+  mu_assert(TmTable_insert(&table, KEY(7)) == slot, "Inserting twice should find the entry.");
+  mu_assert(table.count == 100, "Inserting twice shouldn't add an entry.");
+
+  TmTable_free(&table);
+  return NULL;
+}
+
+char *test_remove()
+{
+  TmTable table;
+  mu_assert(TmTable_init(&table, 16) == 0, "Failed to create table.");
+  int capacity = table.capacity;
+
+  for(int i=0; i < 16; i++) TmTable_insert(&table, KEY(i));
+  for(int i=0; i < 16; i += 2) TmTable_remove_at(&table, TmTable_find(&table, KEY(i)));
+
+  mu_assert(table.count == 8, "Removed entries shouldn't be counted.");
+  for(int i=0; i < 16; i++) {
+    mu_assert((TmTable_find(&table, KEY(i)) >= 0) == (i % 2 == 1), "Probing should carry on past tombstones.");
+  }
+
+  // Churn leaves tombstones behind, which resizing clears without growing.
+  for(int i=16; i < 1000; i++) {
+    TmTable_insert(&table, KEY(i));
+    TmTable_remove_at(&table, TmTable_find(&table, KEY(i)));
+  }
+  mu_assert(table.count == 8, "Wrong number of entries after churn.");
+  mu_assert(table.capacity == capacity, "Tombstones shouldn't make the table grow.");
+
+  TmTable_free(&table);
+  return NULL;
+}
+
+char *all_tests() {
+  mu_suite_start();
+
+  mu_run_test(test_insert_and_find);
+  mu_run_test(test_remove);
+
+  return NULL;
+}
+
+RUN_TESTS(all_tests);
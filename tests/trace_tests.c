@@ -0,0 +1,203 @@
+#define _POSIX_C_SOURCE 200809L
+#include "minunit.h"
+#include <unistd.h>
+#define FIXTURE_CHILDREN
+#include "fixture.h"
+#include <treadmill/trace.h>
+#include <treadmill/region.h>
+
+// Only leaves are allocated in regions here.
+void
+test_scan_slots(TmHeap *heap, TmObjectHeader *object, TmSlotFn callback)
+{
+}
+
+static void
+Object_push(TmHeap *heap, Object *parent, Object *child)
+{
+  Tm_DArray_push(parent->children, child);
+  Tm_write_barrier(heap, (TmObjectHeader*)parent, Tm_DArray_count(parent->children) - 1,
+    (TmObjectHeader*)child);
+}
+
+typedef struct counts_s {
+  int allocations;
+  int writes;
+  int flips;
+  int roots;
+  int released;
+  int ended;
+  uint64_t last_write_object;
+  uint64_t last_write_value;
+  uint64_t last_released;
+} Counts;
+
+static Counts
+read_counts(FILE *file)
+{
+  Counts counts = { 0 };
+  TmTraceEvent event;
+
+  fflush(file);
+  lseek(fileno(file), 0, SEEK_SET);
+  TmTraceReader *reader = TmTraceReader_open(fileno(file));
+  if(reader == NULL) return counts;
+  if(TmTraceReader_object_size(reader) != sizeof(Object)) goto done;
+
+  int result = 0;
+  while((result = TmTraceReader_next(reader, &event)) == 1) {
+    switch(event.type) {
+      case TM_TRACE_ALLOCATE: counts.allocations++; break;
+      case TM_TRACE_FLIP:     counts.flips++; break;
+      case TM_TRACE_ROOTS:    counts.roots = event.count; break;
+      case TM_TRACE_WRITE:
+        counts.writes++;
+        counts.last_write_object = event.object;
+        counts.last_write_value  = event.value;
+        break;
+      case TM_TRACE_RELEASE:
+        counts.released++;
+        counts.last_released = event.object;
+        break;
+    }
+  }
+  counts.ended = result == 0;
+
+done:
+  TmTraceReader_close(reader);
+  return counts;
+}
+
+char *test_TmTrace_record()
+{
+  State *state = State_new();
+  TmHeap *heap = test_heap(state, 10, 100);
+
+  FILE *file = tmpfile();
+  mu_assert(file != NULL, "Couldn't create a temporary file.");
+  mu_assert(TmTrace_start(heap, fileno(file)) == 0, "Couldn't start tracing.");
+  mu_assert(TmTrace_start(heap, fileno(file)) == -1, "Shouldn't trace twice.");
+
+  Object *parent = Object_new(heap);
+  Tm_DArray_push(state->registers, parent);
+  Object_push(heap, parent, Object_new(heap));
+  Object_push(heap, parent, Object_new(heap));
+  Object_new(heap); // unreachable
+
+  Tm_flip(heap);
+  Tm_flip(heap);
+
+  mu_assert(TmTrace_stop(heap) == 0, "Couldn't stop tracing.");
+  mu_assert(heap->trace == NULL, "The heap should stop tracing.");
+
+  Counts counts = read_counts(file);
+  fclose(file);
+
+  mu_assert(counts.ended, "Trace should be terminated.");
+  mu_assert(counts.allocations == 4, "Wrong number of allocations.");
+  mu_assert(counts.writes == 2, "Wrong number of writes.");
+  mu_assert(counts.last_write_object == 1 && counts.last_write_value == 3,
+    "Writes should refer to objects by number.");
+  mu_assert(counts.flips == 2, "Wrong number of flips.");
+  mu_assert(counts.roots == 1, "Wrong number of roots.");
+  mu_assert(counts.released == 1 && counts.last_released == 4,
+    "Only the unreachable object should be released.");
+
+  TmHeap_destroy(heap);
+  State_destroy(state);
+  return NULL;
+}
+
+char *test_TmTrace_existing_objects()
+{
+  State *state = State_new();
+  TmHeap *heap = test_heap(state, 10, 100);
+
+  Object *parent = Object_new(heap);
+  Tm_DArray_push(state->registers, parent);
+  Tm_DArray_push(parent->children, Object_new(heap));
+
+  FILE *file = tmpfile();
+  mu_assert(TmTrace_start(heap, fileno(file)) == 0, "Couldn't start tracing.");
+  Object_push(heap, Object_new(heap), parent);
+  mu_assert(TmTrace_stop(heap) == 0, "Couldn't stop tracing.");
+
+  Counts counts = read_counts(file);
+  fclose(file);
+
+  mu_assert(counts.allocations == 3, "Existing objects should be recorded as allocations.");
+  mu_assert(counts.writes == 2, "Existing pointers should be recorded as writes.");
+  mu_assert(counts.last_write_object == 3 && counts.last_write_value == 1,
+    "Existing objects should be numbered first.");
+
+  TmHeap_destroy(heap);
+  State_destroy(state);
+  return NULL;
+}
+
+char *test_TmTrace_destroy()
+{
+  State *state = State_new();
+  TmHeap *heap = test_heap(state, 10, 100);
+
+  FILE *file = tmpfile();
+  mu_assert(TmTrace_start(heap, fileno(file)) == 0, "Couldn't start tracing.");
+  Object_new(heap);
+  TmHeap_destroy(heap);
+
+  Counts counts = read_counts(file);
+  fclose(file);
+
+  mu_assert(counts.ended, "Destroying the heap should end the trace.");
+  mu_assert(counts.allocations == 1, "Wrong number of allocations.");
+
+  State_destroy(state);
+  return NULL;
+}
+
+char *test_TmTrace_region()
+{
+  State *state = State_new();
+  TmHeap *heap = test_heap(state, 10, 100);
+  heap->scan_slots = test_scan_slots;
+
+  FILE *file = tmpfile();
+  mu_assert(TmTrace_start(heap, fileno(file)) == 0, "Couldn't start tracing.");
+
+  Tm_region_begin(heap);
+  Tm_DArray *escaping = Tm_DArray_create(sizeof(Object*), 1);
+  Tm_DArray_push(escaping, Tm_allocate_flags(heap, TM_LEAF));
+  Tm_allocate_flags(heap, TM_LEAF); // dropped
+  Tm_region_end(heap, escaping);
+
+  Object *parent = Object_new(heap);
+  Object_push(heap, parent, (Object*)Tm_DArray_at(escaping, 0));
+  Tm_DArray_destroy(escaping);
+  mu_assert(TmTrace_stop(heap) == 0, "Couldn't stop tracing.");
+
+  Counts counts = read_counts(file);
+  fclose(file);
+
+  mu_assert(counts.allocations == 3, "Region objects should be recorded as allocations.");
+  mu_assert(counts.released == 1 && counts.last_released == 2,
+    "Region objects left behind should be recorded as released.");
+  mu_assert(counts.last_write_object == 3 && counts.last_write_value == 1,
+    "Survivors should keep their number.");
+
+  TmHeap_destroy(heap);
+  State_destroy(state);
+  return NULL;
+}
+
+char *all_tests() {
+  mu_suite_start();
+
+  mu_run_test(test_TmTrace_record);
+  mu_run_test(test_TmTrace_existing_objects);
+  mu_run_test(test_TmTrace_destroy);
+  mu_run_test(test_TmTrace_region);
+
+  return NULL;
+}
+
+RUN_TESTS(all_tests);
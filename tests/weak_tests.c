@@ -0,0 +1,109 @@
+#include "minunit.h"
+#define FIXTURE_CHILDREN
+#include "fixture.h"
+#include <treadmill/weak.h>
+
+char *test_TmWeakRef_cleared()
+{
+  State *state = State_new();
+  TmHeap *heap = test_heap(state, 10, 100);
+
+  Object *root = Object_new(heap);
+  Tm_DArray_push(state->registers, root);
+  Object *garbage = Object_new(heap);
+
+  TmWeakRef *live = TmWeakRef_new(heap, (TmObjectHeader*)root);
+  TmWeakRef *dead = TmWeakRef_new(heap, (TmObjectHeader*)garbage);
+
+  Tm_flip(heap);
+  mu_assert(dead->target != NULL, "Black objects shouldn't be cleared.");
+
+  Tm_flip(heap);
+  mu_assert(dead->target == NULL, "Collected objects should be cleared.");
+  mu_assert(TmWeakRef_get(heap, live) == (TmObjectHeader*)root,
+      "Reachable objects should be kept.");
+
+  TmWeakRef_destroy(heap, dead);
+  mu_assert(heap->weak_refs == live, "Destroyed refs should be unregistered.");
+
+  // The remaining ref is freed along with the heap.
+  TmHeap_destroy(heap);
+  State_destroy(state);
+  return NULL;
+}
+
+char *test_TmWeakRef_get_shades()
+{
+  State *state = State_new();
+  TmHeap *heap = test_heap(state, 10, 100);
+
+  Object *obj = Object_new(heap);
+  TmWeakRef *ref = TmWeakRef_new(heap, (TmObjectHeader*)obj);
+
+  Tm_flip(heap);
+  mu_assert(obj->gc.cell->ecru, "Unrooted objects should be ecru after a flip.");
+
+  // Reading the reference mid-cycle hands the object back to the mutator.
+  mu_assert(TmWeakRef_get(heap, ref) == (TmObjectHeader*)obj, "Wrong target.");
+  mu_assert(!obj->gc.cell->ecru, "Reading a weak ref should shade its target.");
+
+  Tm_flip(heap);
+  mu_assert(ref->target == (TmObjectHeader*)obj, "Shaded objects should survive.");
+
+  TmHeap_destroy(heap);
+  State_destroy(state);
+  return NULL;
+}
+
+char *test_TmWeakTable()
+{
+  State *state = State_new();
+  TmHeap *heap = test_heap(state, 100, 100);
+  TmWeakTable *table = TmWeakTable_new(heap, 2);
+
+  Object *objects[40];
+  for(int i=0; i < 40; i++) {
+    objects[i] = Object_new(heap);
+    if(i % 2 == 0) Tm_DArray_push(state->registers, objects[i]);
+    mu_assert(TmWeakTable_put(table, (TmObjectHeader*)objects[i], objects[i]) == 0,
+        "Failed to insert.");
+  }
+
+  mu_assert(TmWeakTable_count(table) == 40, "Wrong number of entries.");
+  mu_assert(TmWeakTable_get(table, (TmObjectHeader*)objects[7]) == objects[7],
+      "Wrong value.");
+  mu_assert(TmWeakTable_remove(table, (TmObjectHeader*)objects[8]) == objects[8],
+      "Wrong removed value.");
+  mu_assert(TmWeakTable_get(table, (TmObjectHeader*)objects[8]) == NULL,
+      "Removed entries should be gone.");
+
+  Tm_flip(heap);
+  Tm_flip(heap);
+
+  // Only the rooted half survives, minus the entry removed by hand.
+  mu_assert(TmWeakTable_count(table) == 19, "Dead keys should be dropped.");
+  for(int i=0; i < 40; i += 2) {
+    if(i == 8) continue;
+    mu_assert(TmWeakTable_get(table, (TmObjectHeader*)objects[i]) == objects[i],
+        "Live keys should be kept.");
+  }
+
+  TmWeakTable_destroy(heap, table);
+  mu_assert(heap->weak_tables == NULL, "Destroyed tables should be unregistered.");
+
+  TmHeap_destroy(heap);
+  State_destroy(state);
+  return NULL;
+}
+
+char *all_tests() {
+  mu_suite_start();
+
+  mu_run_test(test_TmWeakRef_cleared);
+  mu_run_test(test_TmWeakRef_get_shades);
+  mu_run_test(test_TmWeakTable);
+
+  return NULL;
+}
+
+RUN_TESTS(all_tests);
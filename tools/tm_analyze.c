@@ -0,0 +1,314 @@
+/*
+ * Offline analyzer for heap snapshots written by TmHeap_snapshot.
+ *
+ * Builds the object graph, computes the dominator tree from a virtual root
+ * pointing at every object in the rootset (Cooper, Harvey & Kennedy's
+ * iterative algorithm) and reports the objects retaining the most memory.
+ *
+ *   $ build/tm_analyze heap.snapshot [top]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <treadmill/snapshot.h>
+
+typedef struct node_s {
+  uint64_t id;
+  uint64_t size;
+  uint64_t retained;
+  unsigned char colour;
+} Node;
+
+typedef struct edge_s {
+  int from;
+  uint64_t to;
+} Edge;
+
+typedef struct lookup_s {
+  uint64_t id;
+  int index;
+} Lookup;
+
+typedef struct graph_s {
+  Node *nodes;
+  int node_count;
+  int node_max;
+
+  Edge *edges;
+  int edge_count;
+  int edge_max;
+
+  uint64_t *roots;
+  int root_count;
+  int root_max;
+} Graph;
+
+static const char *colours[] = { "white", "ecru", "grey", "black" };
+
+static void *
+grow(void *memory, int *max, size_t size)
+{
+  *max = *max ? *max * 2 : 1024;
+  void *grown = realloc(memory, *max * size);
+  check_mem(grown);
+  return grown;
+error:
+  exit(EXIT_FAILURE);
+}
+
+static int
+read_exactly(FILE *file, void *data, size_t size)
+{
+  return fread(data, size, 1, file) == 1;
+}
+
+static int
+read_snapshot(FILE *file, Graph *graph)
+{
+  uint32_t magic, version;
+  uint64_t object_size;
+
+  check(read_exactly(file, &magic, sizeof(magic)) && magic == TM_SNAPSHOT_MAGIC,
+      "Not a heap snapshot.");
+  check(read_exactly(file, &version, sizeof(version)) && version == TM_SNAPSHOT_VERSION,
+      "Unsupported snapshot version.");
+  check(read_exactly(file, &object_size, sizeof(object_size)), "Truncated snapshot.");
+
+  // Anything but TM_SNAPSHOT_END, in case the file ends after the header.
+  unsigned char tag = 0;
+  uint64_t id;
+
+  while(read_exactly(file, &tag, sizeof(tag)) && tag != TM_SNAPSHOT_END) {
+    check(read_exactly(file, &id, sizeof(id)), "Truncated snapshot.");
+
+    switch(tag) {
+      case TM_SNAPSHOT_ROOT:
+        if(graph->root_count == graph->root_max) {
+          graph->roots = grow(graph->roots, &graph->root_max, sizeof(uint64_t));
+        }
+        graph->roots[graph->root_count++] = id;
+        break;
+      case TM_SNAPSHOT_NODE:
+        if(graph->node_count == graph->node_max) {
+          graph->nodes = grow(graph->nodes, &graph->node_max, sizeof(Node));
+        }
+        Node *node = &graph->nodes[graph->node_count++];
+        node->id = id;
+        check(read_exactly(file, &node->colour, sizeof(node->colour)) &&
+            read_exactly(file, &node->size, sizeof(node->size)),
+            "Truncated snapshot.");
+        break;
+      case TM_SNAPSHOT_EDGE:
+        check(graph->node_count > 0, "Edge before any node.");
+        if(graph->edge_count == graph->edge_max) {
+          graph->edges = grow(graph->edges, &graph->edge_max, sizeof(Edge));
+        }
+        graph->edges[graph->edge_count].from = graph->node_count - 1;
+        graph->edges[graph->edge_count].to   = id;
+        graph->edge_count++;
+        break;
+      default:
+        sentinel("Unknown record '%c'.", tag);
+    }
+  }
+
+  check(tag == TM_SNAPSHOT_END, "Truncated snapshot.");
+  return 0;
+
+error:
+  return -1;
+}
+
+static int
+compare_lookup(const void *a, const void *b)
+{
+  uint64_t x = ((const Lookup*)a)->id;
+  uint64_t y = ((const Lookup*)b)->id;
+  return (x > y) - (x < y);
+}
+
+// Returns the graph vertex of an object id, or -1. Vertex 0 is the virtual
+// root, so object i is vertex i + 1.
+static int
+vertex_of(Lookup *lookup, int count, uint64_t id)
+{
+  Lookup key = { .id = id };
+  Lookup *found = bsearch(&key, lookup, count, sizeof(Lookup), compare_lookup);
+  return found ? found->index + 1 : -1;
+}
+
+static int
+intersect(int *idom, int *postorder, int a, int b)
+{
+  while(a != b) {
+    while(postorder[a] < postorder[b]) a = idom[a];
+    while(postorder[b] < postorder[a]) b = idom[b];
+  }
+  return a;
+}
+
+static Node *ranked_nodes = NULL;
+
+static int
+compare_retained(const void *a, const void *b)
+{
+  uint64_t x = ranked_nodes[*(const int*)a].retained;
+  uint64_t y = ranked_nodes[*(const int*)b].retained;
+  return (x < y) - (x > y);
+}
+
+int
+main(int argc, char *argv[])
+{
+  check(argc >= 2, "Usage: %s <snapshot> [top]", argv[0]);
+  int top = argc > 2 ? atoi(argv[2]) : 20;
+
+  FILE *file = fopen(argv[1], "rb");
+  check(file, "Can't open %s.", argv[1]);
+
+  Graph graph = { 0 };
+  check(read_snapshot(file, &graph) == 0, "Failed to read %s.", argv[1]);
+  fclose(file);
+
+  int n = graph.node_count;
+  int vertices = n + 1;
+
+  Lookup *lookup = calloc(n + 1, sizeof(Lookup));
+  check_mem(lookup);
+  for(int i=0; i < n; i++) {
+    lookup[i].id = graph.nodes[i].id;
+    lookup[i].index = i;
+  }
+  qsort(lookup, n, sizeof(Lookup), compare_lookup);
+
+  // Successor and predecessor lists in compressed row form.
+  int edge_total = graph.edge_count + graph.root_count;
+  int *from = calloc(edge_total + 1, sizeof(int));
+  int *to   = calloc(edge_total + 1, sizeof(int));
+  check_mem(from && to);
+
+  int m = 0;
+  for(int i=0; i < graph.root_count; i++) {
+    int v = vertex_of(lookup, n, graph.roots[i]);
+    if(v < 0) continue;
+    from[m] = 0; to[m] = v; m++;
+  }
+  for(int i=0; i < graph.edge_count; i++) {
+    int v = vertex_of(lookup, n, graph.edges[i].to);
+    if(v < 0) continue;
+    from[m] = graph.edges[i].from + 1; to[m] = v; m++;
+  }
+
+  int *succ_start = calloc(vertices + 1, sizeof(int));
+  int *pred_start = calloc(vertices + 1, sizeof(int));
+  int *succ = calloc(m + 1, sizeof(int));
+  int *pred = calloc(m + 1, sizeof(int));
+  check_mem(succ_start && pred_start && succ && pred);
+
+  for(int i=0; i < m; i++) {
+    succ_start[from[i] + 1]++;
+    pred_start[to[i] + 1]++;
+  }
+  for(int v=0; v < vertices; v++) {
+    succ_start[v + 1] += succ_start[v];
+    pred_start[v + 1] += pred_start[v];
+  }
+  int *succ_fill = calloc(vertices, sizeof(int));
+  int *pred_fill = calloc(vertices, sizeof(int));
+  check_mem(succ_fill && pred_fill);
+  for(int i=0; i < m; i++) {
+    succ[succ_start[from[i]] + succ_fill[from[i]]++] = to[i];
+    pred[pred_start[to[i]] + pred_fill[to[i]]++] = from[i];
+  }
+
+  // Iterative depth-first search for a postorder numbering.
+  int *postorder = malloc(vertices * sizeof(int));
+  int *order     = malloc(vertices * sizeof(int)); // vertices by postorder
+  int *stack     = malloc(vertices * sizeof(int));
+  int *cursor    = calloc(vertices, sizeof(int));
+  check_mem(postorder && order && stack && cursor);
+  for(int v=0; v < vertices; v++) postorder[v] = -1;
+
+  int reached = 0, depth = 0;
+  stack[depth++] = 0;
+  cursor[0] = succ_start[0];
+  postorder[0] = -2; // on the stack
+  while(depth > 0) {
+    int v = stack[depth - 1];
+    if(cursor[v] < succ_start[v + 1]) {
+      int w = succ[cursor[v]++];
+      if(postorder[w] == -1) {
+        postorder[w] = -2;
+        cursor[w] = succ_start[w];
+        stack[depth++] = w;
+      }
+    } else {
+      postorder[v] = reached;
+      order[reached++] = v;
+      depth--;
+    }
+  }
+
+  int *idom = malloc(vertices * sizeof(int));
+  check_mem(idom);
+  for(int v=0; v < vertices; v++) idom[v] = -1;
+  idom[0] = 0;
+
+  int changed = 1;
+  while(changed) {
+    changed = 0;
+    // Reverse postorder, skipping the virtual root.
+    for(int i = reached - 2; i >= 0; i--) {
+      int v = order[i];
+      int new_idom = -1;
+      for(int p = pred_start[v]; p < pred_start[v + 1]; p++) {
+        int u = pred[p];
+        if(idom[u] == -1) continue;
+        new_idom = new_idom == -1 ? u : intersect(idom, postorder, u, new_idom);
+      }
+      if(idom[v] != new_idom) {
+        idom[v] = new_idom;
+        changed = 1;
+      }
+    }
+  }
+
+  uint64_t total = 0, live = 0;
+  for(int i=0; i < n; i++) {
+    graph.nodes[i].retained = graph.nodes[i].size;
+    total += graph.nodes[i].size;
+  }
+  for(int i=0; i < reached - 1; i++) {
+    int v = order[i];
+    live += graph.nodes[v - 1].size;
+    if(idom[v] > 0) graph.nodes[idom[v] - 1].retained += graph.nodes[v - 1].retained;
+  }
+
+  printf("Objects:     %d (%llu bytes)\n", n, (unsigned long long)total);
+  printf("Edges:       %d\n", graph.edge_count);
+  printf("Roots:       %d\n", graph.root_count);
+  printf("Reachable:   %d (%llu bytes)\n", reached - 1, (unsigned long long)live);
+  printf("Unreachable: %d (%llu bytes)\n", n - (reached - 1), (unsigned long long)(total - live));
+
+  int *ranked = malloc((n + 1) * sizeof(int));
+  check_mem(ranked);
+  int ranked_count = 0;
+  for(int i=0; i < reached - 1; i++) ranked[ranked_count++] = order[i] - 1;
+  ranked_nodes = graph.nodes;
+  qsort(ranked, ranked_count, sizeof(int), compare_retained);
+
+  printf("\n%-18s %-6s %12s %14s\n", "object", "colour", "size", "retained");
+  for(int i=0; i < ranked_count && i < top; i++) {
+    Node *node = &graph.nodes[ranked[i]];
+    printf("0x%016llx %-6s %12llu %14llu\n",
+        (unsigned long long)node->id,
+        colours[node->colour & 3],
+        (unsigned long long)node->size,
+        (unsigned long long)node->retained);
+  }
+
+  return 0;
+
+error:
+  return 1;
+}
@@ -0,0 +1,270 @@
+/*
+ * Replays an allocation trace written by TmTrace_start against a fresh heap,
+ * so collector settings can be compared offline on the same workload.
+ *
+ * Objects are stand-ins holding the pointers the trace wrote into them, so
+ * the replayed heap has the recorded shape whatever the original objects
+ * looked like. The rootset is the one recorded by the last flip, plus every
+ * object allocated since then, since the program may hold those in
+ * variables the trace can't see. Unless `follow` is given, flips happen
+ * whenever the replayed heap decides, not where the recording did.
+ *
+ *   $ build/tm_replay trace.bin [size growth_rate scan_every [follow]]
+ *
+ * Reports throughput and the distribution of pauses, i.e. the time spent in
+ * each Tm_allocate or Tm_flip call.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <treadmill/gc.h>
+#include <treadmill/trace.h>
+
+typedef struct edge_s {
+  uint64_t field;
+  struct object_s *to;
+} Edge;
+
+typedef struct object_s {
+  TmObjectHeader gc;
+  uint64_t id;
+  Tm_Vec(Edge) edges;
+} Object;
+
+typedef struct state_s {
+  TmStateHeader gc;
+  Tm_Vec(uint64_t) roots;
+  Tm_Vec(uint64_t) young;
+} State;
+
+static Tm_Vec(Object*) objects;
+static Tm_Vec(double) pauses;
+static unsigned long long released = 0;
+static int flips = 0;
+
+static Tm_DArray*
+replay_rootset(TmStateHeader *state_h)
+{
+  State *state = (State*)state_h;
+  Tm_DArray *rootset = Tm_DArray_create(sizeof(TmObjectHeader*),
+    Tm_Vec_count(&state->roots) + Tm_Vec_count(&state->young) + 1);
+
+  for(int i=0; i < Tm_Vec_count(&state->roots); i++) {
+    Object *object = Tm_Vec_at(&objects, Tm_Vec_at(&state->roots, i));
+    if(object) Tm_DArray_push(rootset, object);
+  }
+  for(int i=0; i < Tm_Vec_count(&state->young); i++) {
+    Object *object = Tm_Vec_at(&objects, Tm_Vec_at(&state->young, i));
+    if(object) Tm_DArray_push(rootset, object);
+  }
+
+  flips++;
+  return rootset;
+}
+
+static void
+replay_scan_pointers(TmHeap *heap, TmObjectHeader *object, TmCallbackFn callback)
+{
+  Object *self = (Object*)object;
+  for(int i=0; i < Tm_Vec_count(&self->edges); i++) {
+    callback(heap, (TmObjectHeader*)Tm_Vec_at(&self->edges, i).to);
+  }
+}
+
+static void
+replay_release(void *value)
+{
+  Object *self = (Object*)value;
+  Tm_Vec_at(&objects, self->id) = NULL;
+  Tm_Vec_free(&self->edges);
+  free(self);
+  released++;
+}
+
+static inline Object*
+object_at(uint64_t id)
+{
+  return id < (uint64_t)Tm_Vec_count(&objects) ? Tm_Vec_at(&objects, id) : NULL;
+}
+
+static void
+write_edge(Object *object, uint64_t field, Object *value)
+{
+  for(int i=0; i < Tm_Vec_count(&object->edges); i++) {
+    Edge *edge = &Tm_Vec_at(&object->edges, i);
+    if(edge->field != field) continue;
+
+    if(value) {
+      edge->to = value;
+    } else {
+      *edge = Tm_Vec_pop(&object->edges);
+    }
+    return;
+  }
+
+  if(value) {
+    Edge edge = { field, value };
+    Tm_Vec_push(&object->edges, edge);
+  }
+}
+
+static inline double
+now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+compare_doubles(const void *a, const void *b)
+{
+  double x = *(const double*)a;
+  double y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+static double
+percentile(double p)
+{
+  int count = Tm_Vec_count(&pauses);
+  if(count == 0) return 0;
+
+  int i = (int)(p * (count - 1));
+  return Tm_Vec_at(&pauses, i);
+}
+
+int
+main(int argc, char *argv[])
+{
+  check(argc >= 2, "Usage: %s <trace> [size growth_rate scan_every [follow]]", argv[0]);
+  int size        = argc > 2 ? atoi(argv[2]) : 1000;
+  int growth_rate = argc > 3 ? atoi(argv[3]) : 1000;
+  int scan_every  = argc > 4 ? atoi(argv[4]) : 100;
+  int follow      = argc > 5 && strcmp(argv[5], "follow") == 0;
+
+  int fd = open(argv[1], O_RDONLY);
+  check(fd >= 0, "Can't open %s.", argv[1]);
+
+  TmTraceReader *reader = TmTraceReader_open(fd);
+  check(reader, "Failed to read %s.", argv[1]);
+
+  State state = { .gc = { .rootset = replay_rootset } };
+  Tm_Vec_init(&state.roots);
+  Tm_Vec_init(&state.young);
+  Tm_Vec_init(&objects);
+  Tm_Vec_init(&pauses);
+  Tm_Vec_push(&objects, NULL); // 0 is NULL
+
+  TmHeap *heap = TmHeap_new((TmStateHeader*)&state, size, growth_rate, scan_every,
+    sizeof(Object), replay_release, replay_scan_pointers);
+
+  unsigned long long allocations = 0, failed = 0, writes = 0, missing = 0;
+  unsigned long long recorded_flips = 0, recorded_releases = 0;
+  int pending_flip = 0, result = 0;
+  double busy = 0, start = now();
+  TmTraceEvent event;
+
+  while((result = TmTraceReader_next(reader, &event)) == 1) {
+    switch(event.type) {
+      case TM_TRACE_ALLOCATE: {
+        // Image objects are recorded as immortals, which they are.
+        double t0 = now();
+        Object *object = (Object*)Tm_allocate_flags(heap, event.flags & ~TM_IMAGE);
+        double pause = now() - t0;
+
+        busy += pause;
+        Tm_Vec_push(&pauses, pause);
+        allocations++;
+
+        if(object) {
+          object->id = event.object;
+          Tm_Vec_init(&object->edges);
+          Tm_Vec_push(&state.young, event.object);
+        } else {
+          failed++;
+        }
+        Tm_Vec_push(&objects, object);
+        break;
+      }
+      case TM_TRACE_WRITE: {
+        Object *object = object_at(event.object);
+        Object *value  = object_at(event.value);
+        writes++;
+
+        if(object == NULL || (event.value != 0 && value == NULL)) missing++;
+        if(object == NULL) break;
+
+        // The trace can't tell how the program kept its writes safe from an
+        // incremental scan, so shade whatever is stored.
+        if(value) Tm_shade(heap, (TmObjectHeader*)value);
+        write_edge(object, event.field, value);
+        Tm_write_barrier(heap, (TmObjectHeader*)object, event.field, (TmObjectHeader*)value);
+        break;
+      }
+      case TM_TRACE_FLIP:
+        recorded_flips++;
+        // The rootset of that flip comes next.
+        pending_flip = follow;
+        break;
+      case TM_TRACE_ROOTS:
+        Tm_Vec_clear(&state.roots);
+        Tm_Vec_clear(&state.young);
+        for(uint64_t i=0; i < event.count; i++) {
+          if(event.roots[i] != 0) Tm_Vec_push(&state.roots, event.roots[i]);
+        }
+
+        if(pending_flip) {
+          double t0 = now();
+          Tm_flip(heap);
+          double pause = now() - t0;
+
+          busy += pause;
+          Tm_Vec_push(&pauses, pause);
+          pending_flip = 0;
+        }
+        break;
+      case TM_TRACE_RELEASE:
+        recorded_releases++;
+        break;
+    }
+  }
+  double elapsed = now() - start;
+  check(result == 0, "Failed to read %s.", argv[1]);
+
+  qsort(pauses.contents, Tm_Vec_count(&pauses), sizeof(double), compare_doubles);
+  double total = 0;
+  for(int i=0; i < Tm_Vec_count(&pauses); i++) total += Tm_Vec_at(&pauses, i);
+
+  printf("trace:       %s (%llu byte objects)\n", argv[1],
+    (unsigned long long)TmTraceReader_object_size(reader));
+  printf("settings:    size %i, growth_rate %i, scan_every %i%s\n",
+    size, growth_rate, scan_every, follow ? ", recorded flips" : "");
+  printf("allocations: %llu (%llu failed)\n", allocations, failed);
+  printf("writes:      %llu (%llu to or from collected objects)\n", writes, missing);
+  printf("flips:       %i (%llu recorded)\n", flips, recorded_flips);
+  printf("released:    %llu (%llu recorded)\n", released, recorded_releases);
+  printf("cells:       %i\n", heap->capacity);
+  printf("time:        %8.3f s (%.3f s in the heap, %.0f allocations/s)\n",
+    elapsed, busy, busy > 0 ? allocations / busy : 0);
+  printf("pauses:      mean %.2f us, p99 %.2f us, p99.9 %.2f us, max %.2f us\n",
+    Tm_Vec_count(&pauses) ? total / Tm_Vec_count(&pauses) * 1e6 : 0,
+    percentile(0.99) * 1e6, percentile(0.999) * 1e6, percentile(1) * 1e6);
+
+  TmHeap_destroy(heap);
+  TmTraceReader_close(reader);
+  close(fd);
+
+  Tm_Vec_free(&objects);
+  Tm_Vec_free(&pauses);
+  Tm_Vec_free(&state.roots);
+  Tm_Vec_free(&state.young);
+  return 0;
+
+error:
+  return 1;
+}